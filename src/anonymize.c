@@ -30,31 +30,23 @@
 #include <gcrypt.h>
 #endif
 
+#ifdef PACKAGE
+static char *program = PACKAGE;
+#else
+static char *program = "ffe";
+#endif
+
 #define MAX_NFIELD_LEN 262144
 
 #define CRYPT_ASCII_CHARS "0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
 #define CRYPT_NUMBER_CHARS "0123456789"
 
-static uint8_t bcd_to_ascii[]={'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','\000'};
-
 static char crypt_ascii_chars[]=CRYPT_ASCII_CHARS;
 static char crypt_number_chars[]=CRYPT_NUMBER_CHARS;
 
 #define NUM_ASCII_CHARS  (sizeof(crypt_ascii_chars) - 1)
 #define NUM_NUMBER_CHARS  (sizeof(crypt_number_chars) - 1)
 
-static inline uint8_t
-bcdtocl(uint8_t bcd)
-{
-        return bcd_to_ascii[bcd & 0x0f];
-}
-
-static inline uint8_t
-bcdtocb(uint8_t bcd)
-{
-        return bcd_to_ascii[(bcd >> 4) & 0x0f];
-}
-
 
 /* Init libgcrypt
  */
@@ -73,7 +65,8 @@ void init_libgcrypt()
  * return nbuffer data length
  * rules:
  * - binary data (execpt little endian hex values) and text n fixed and separated data is written as it is
- * - bcd values are written as clear text numbers
+ * - bcd values are written as clear text numbers, comp-3 values without the sign
+ * - text in a structure having a code page is translated to ISO-8859-1
  * - little endian hex vlaues are written in big endian order
  */
 static int get_normalized_field(struct field *f,char *type,uint8_t quote,int len,uint8_t *buffer,uint8_t *nbuffer)
@@ -84,8 +77,6 @@ static int get_normalized_field(struct field *f,char *type,uint8_t quote,int len
    int inside_quote;
    uint8_t separator;
    uint8_t *start;
-   uint8_t c;
-   uint8_t *data_end;
    uint8_t *stop;
   
 
@@ -101,19 +92,36 @@ static int get_normalized_field(struct field *f,char *type,uint8_t quote,int len
            if(copy_length)
            {
 #ifdef WIN32
-               while(i < copy_length && data[i] != '\n' && data[i] != '\r' && data[i]) nbuffer[i] = data[i++];
+               while(i < copy_length && data[i] != '\n' && data[i] != '\r' && data[i])
+               {
+                   nbuffer[i] = data[i];
+                   i++;
+               }
 #else
-               while(i < copy_length && data[i] != '\n' && data[i]) nbuffer[i] = data[i++];
+               while(i < copy_length && data[i] != '\n' && data[i])
+               {
+                   nbuffer[i] = data[i];
+                   i++;
+               }
 #endif
            } else
            {
 #ifdef WIN32
-               while(data[i] != '\n' && data[i] != '\r' && data[i]) nbuffer[i] = data[i++];
+               while(data[i] != '\n' && data[i] != '\r' && data[i])
+               {
+                   nbuffer[i] = data[i];
+                   i++;
+               }
 #else
-               while(data[i] != '\n' && data[i]) nbuffer[i] = data[i++];
+               while(data[i] != '\n' && data[i])
+               {
+                   nbuffer[i] = data[i];
+                   i++;
+               }
 #endif
            }
            copy_length = i;
+           if(input_decode != NULL) translate(input_decode,nbuffer,copy_length);
            break;
        case SEPARATED:
            separator = type[1];
@@ -180,41 +188,18 @@ static int get_normalized_field(struct field *f,char *type,uint8_t quote,int len
                    {
                        memcpy(nbuffer,&buffer[f->bposition],copy_length);
                    }
+                   if(input_decode != NULL && (f->type == F_ASC || f->type == F_CHAR)) translate(input_decode,nbuffer,copy_length);
                    break;
                case F_BCD:
-                   data = &buffer[f->bposition];
-                   data_end = data + f->length;
-                   i = 0;
-                   switch(f->endianess)
-                   {
-                       case F_BIG_ENDIAN:
-                           do
-                           {
-                               c = bcdtocb(*data);
-                               if(c)
-                               {
-                                   nbuffer[i++] = c;
-                                   c = bcdtocl(*data);
-                                   if(c) nbuffer[i++] = c;
-                               }
-                               data++;
-                           } while(data < data_end && c);
-                           break;
-                       case F_LITTLE_ENDIAN:
-                           do
-                           {
-                               c = bcdtocl(*data);
-                               if(c)
-                               {
-                                   nbuffer[i++] = c;
-                                   c = bcdtocb(*data);
-                                   if(c) nbuffer[i++] = c;
-                               }
-                               data++;
-                           } while(data < data_end && c);
-                           break;
-                   }
-                   copy_length = i;
+                   copy_length = f->length;
+                   if(2 * copy_length > MAX_NFIELD_LEN) copy_length = MAX_NFIELD_LEN / 2;
+                   copy_length = bcd_expand(nbuffer,&buffer[f->bposition],copy_length,f->endianess,0);
+                   break;
+               case F_COMP3:    /* digits without the sign nybble */
+                   copy_length = f->length;
+                   if(2 * copy_length > MAX_NFIELD_LEN) copy_length = MAX_NFIELD_LEN / 2;
+                   copy_length = hex_expand(nbuffer,&buffer[f->bposition],copy_length,F_BIG_ENDIAN,0) - 1;
+                   break;
            }
            break;
    }
@@ -240,6 +225,7 @@ static void write_scrambled_field(struct field *f,char *type,uint8_t quote,uint8
     {
         case FIXED_LENGTH: 
             memcpy(&buffer[f->bposition],scrambled_data,scramble_len);
+            if(input_encode != NULL) translate(input_encode,&buffer[f->bposition],scramble_len);
             break;
         case SEPARATED:
             quoted = (buffer[f->bposition] == quote && quote) ? 1 : 0 ; 	//skip first quote
@@ -256,6 +242,21 @@ static void write_scrambled_field(struct field *f,char *type,uint8_t quote,uint8
                 case F_UINT:
                 case F_HEX:
                     memcpy(&buffer[f->bposition],scrambled_data,scramble_len);
+                    if(input_encode != NULL && (f->type == F_ASC || f->type == F_CHAR)) translate(input_encode,&buffer[f->bposition],scramble_len);
+                    break;
+                case F_COMP3:   /* digits are packed before the original sign nybble */
+                    data = &buffer[f->bposition];
+                    for(i = 0;i < scramble_len;i++)
+                    {
+                        c = (uint8_t) (ascii_to_bcd(scrambled_data[i]) & 0x0f);
+                        if(i & 1)
+                        {
+                            data[i >> 1] = (data[i >> 1] & 0xf0) | c;
+                        } else
+                        {
+                            data[i >> 1] = (data[i >> 1] & 0x0f) | (c << 4);
+                        }
+                    }
                     break;
                 case F_BCD:  // write in big endian and swap after that if little endian
                     data = &buffer[f->bposition];
@@ -330,6 +331,7 @@ static void scramble_HASH(int ftype,int hash_length,unsigned char *hash,int scra
             }
             break;
         case F_BCD:
+        case F_COMP3:
             i = 0;
             while(i < scramble_length)
             {
@@ -341,10 +343,80 @@ static void scramble_HASH(int ftype,int hash_length,unsigned char *hash,int scra
     }
 }
 
-/* make a hash using libcgryot 
+/* SipHash-2-4 with 128 bit output */
+#define ROTL64(x,b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = ROTL64(v1,13); v1 ^= v0; v0 = ROTL64(v0,32); \
+        v2 += v3; v3 = ROTL64(v3,16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL64(v3,21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL64(v1,17); v1 ^= v2; v2 = ROTL64(v2,32); \
+    } while(0)
+
+static uint64_t
+read_le64(uint8_t *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+           (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static void
+write_le64(unsigned char *p,uint64_t v)
+{
+    int i;
+
+    for(i = 0;i < 8;i++) p[i] = (unsigned char) (v >> (8 * i));
+}
+
+static void
+siphash128(uint64_t *key,uint8_t *input,int input_length,unsigned char *hash)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1] ^ 0xee;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    uint64_t m,b = (uint64_t) input_length << 56;
+    uint8_t *end = input + (input_length - (input_length % 8));
+    int left = input_length & 7;
+
+    while(input != end)
+    {
+        m = read_le64(input);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+        input += 8;
+    }
+
+    while(left--) b |= (uint64_t) input[left] << (8 * left);
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xee;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    write_le64(hash,v0 ^ v1 ^ v2 ^ v3);
+
+    v1 ^= 0xdd;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    write_le64(hash + 8,v0 ^ v1 ^ v2 ^ v3);
+}
+
+/* make a hash using libcgryot or SipHash
  * write hash to hash and return the hash length
+ * libgcrypt handle is kept in anonymization info and reset for every field,
+ * with hash key the hash is HMAC
  */
-static int md_hash(unsigned char *hash,int input_length,uint8_t *input,int bytes)
+static int md_hash(unsigned char *hash,int input_length,uint8_t *input,struct anon_field *a)
 {
     size_t outlen=0;
 #ifdef HAVE_WORKING_LIBGCRYPT
@@ -352,8 +424,27 @@ static int md_hash(unsigned char *hash,int input_length,uint8_t *input,int bytes
     gcry_md_hd_t hd;
     gpg_error_t err;
     unsigned char *p;
+#endif
+
+    if(a->siphash)
+    {
+        if(a->md == NULL)  /* SipHash key is derived from the hash key */
+        {
+            unsigned char k[16];
+
+            a->sipkey[0] = 0;
+            a->sipkey[1] = 0;
+            siphash128(a->sipkey,a->secret != NULL ? a->secret : (uint8_t *) "",a->secret_length,k);
+            a->sipkey[0] = read_le64(k);
+            a->sipkey[1] = read_le64(k + 8);
+            a->md = a->sipkey;
+        }
+        siphash128(a->sipkey,input,input_length,hash);
+        return 16;
+    }
 
-    switch(bytes)
+#ifdef HAVE_WORKING_LIBGCRYPT
+    switch(a->key_length > 0 ? atoi(a->key) : 16)
     {
         case 32:
             algo = GCRY_MD_SHA256;
@@ -369,8 +460,17 @@ static int md_hash(unsigned char *hash,int input_length,uint8_t *input,int bytes
 
     outlen = gcry_md_get_algo_dlen(algo);
 
-    err = gcry_md_open(&hd,algo,0);
-    if(err != GPG_ERR_NO_ERROR) panic("libgcrypt error",NULL,NULL);
+    if(a->md == NULL)
+    {
+        err = gcry_md_open(&hd,algo,a->secret != NULL ? GCRY_MD_FLAG_HMAC : 0);
+        if(err != GPG_ERR_NO_ERROR) panic("libgcrypt error",NULL,NULL);
+        if(a->secret != NULL && gcry_md_setkey(hd,a->secret,a->secret_length) != GPG_ERR_NO_ERROR) panic("libgcrypt error",NULL,NULL);
+        a->md = hd;
+    } else
+    {
+        hd = a->md;
+        gcry_md_reset(hd);
+    }
 
     gcry_md_write(hd,input,input_length);
 
@@ -378,18 +478,133 @@ static int md_hash(unsigned char *hash,int input_length,uint8_t *input,int bytes
     if (p == NULL) panic("libgcrypt error",NULL,NULL);
 
     memcpy(hash,p,outlen);
-
-    gcry_md_close(hd);
 #else
     problem("Libgcrypt not availaible in this system",NULL,NULL);
 #endif
     return outlen;
 }
 
-static int md_random(unsigned char *rand,int rand_length)
+/* ChaCha20 keystream is used as random source for RANDOM and NRANDOM.
+ * The key is taken once from the system random source or from the
+ * seed given in the anonymization block, the buffer is refilled
+ * RANDOM_BLOCKS blocks at a time.
+ */
+#define RANDOM_BLOCKS 64
+
+static uint32_t chacha_state[16];
+static uint8_t random_buffer[RANDOM_BLOCKS * 64];
+static int random_pos = -1;          /* -1 = generator not keyed */
+static uint32_t random_stream = 0;
+
+#define ROTL32(x,b) (uint32_t) (((x) << (b)) | ((x) >> (32 - (b))))
+#define QUARTERROUND(a,b,c,d) \
+    do { \
+        a += b; d ^= a; d = ROTL32(d,16); \
+        c += d; b ^= c; b = ROTL32(b,12); \
+        a += b; d ^= a; d = ROTL32(d,8); \
+        c += d; b ^= c; b = ROTL32(b,7); \
+    } while(0)
+
+static uint32_t
+read_le32(uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void
+chacha20_block(uint32_t *state,uint8_t *out)
+{
+    uint32_t x[16];
+    int i;
+
+    memcpy(x,state,sizeof(x));
+
+    for(i = 0;i < 10;i++)
+    {
+        QUARTERROUND(x[0],x[4],x[8],x[12]);
+        QUARTERROUND(x[1],x[5],x[9],x[13]);
+        QUARTERROUND(x[2],x[6],x[10],x[14]);
+        QUARTERROUND(x[3],x[7],x[11],x[15]);
+        QUARTERROUND(x[0],x[5],x[10],x[15]);
+        QUARTERROUND(x[1],x[6],x[11],x[12]);
+        QUARTERROUND(x[2],x[7],x[8],x[13]);
+        QUARTERROUND(x[3],x[4],x[9],x[14]);
+    }
+
+    for(i = 0;i < 16;i++)
+    {
+        x[i] += state[i];
+        out[4 * i] = (uint8_t) x[i];
+        out[4 * i + 1] = (uint8_t) (x[i] >> 8);
+        out[4 * i + 2] = (uint8_t) (x[i] >> 16);
+        out[4 * i + 3] = (uint8_t) (x[i] >> 24);
+    }
+
+    if(++state[12] == 0) state[13]++;    /* 64 bit block counter */
+}
+
+static void
+init_random(struct anon_field *a)
+{
+    uint8_t key[32];
+    int i;
+
+#ifdef HAVE_WORKING_LIBGCRYPT
+    if(a->seed != NULL)
+    {
+        gcry_md_hash_buffer(GCRY_MD_SHA256,key,a->seed,a->seed_length);
+    } else
+    {
+        gcry_create_nonce(key,sizeof(key));
+    }
+#endif
+
+    chacha_state[0] = 0x61707865;
+    chacha_state[1] = 0x3320646e;
+    chacha_state[2] = 0x79622d32;
+    chacha_state[3] = 0x6b206574;
+    for(i = 0;i < 8;i++) chacha_state[4 + i] = read_le32(&key[4 * i]);
+    for(i = 12;i < 16;i++) chacha_state[i] = 0;
+    chacha_state[14] = random_stream;
+    memset(key,0,sizeof(key));
+    random_pos = sizeof(random_buffer);
+}
+
+/* parallel processes use different streams of the same key */
+void anon_random_stream(int stream)
+{
+    random_stream = (uint32_t) stream;
+    if(random_pos >= 0)
+    {
+        chacha_state[12] = 0;
+        chacha_state[13] = 0;
+        chacha_state[14] = random_stream;
+        random_pos = sizeof(random_buffer);
+    }
+}
+
+static int md_random(unsigned char *rand,int rand_length,struct anon_field *a)
 {
 #ifdef HAVE_WORKING_LIBGCRYPT
-    gcry_create_nonce(rand,rand_length);
+    int i,n,left = rand_length;
+
+    if(random_pos < 0) init_random(a);
+
+    while(left)
+    {
+        if(random_pos == sizeof(random_buffer))
+        {
+            for(i = 0;i < RANDOM_BLOCKS;i++) chacha20_block(chacha_state,&random_buffer[64 * i]);
+            random_pos = 0;
+        }
+        n = sizeof(random_buffer) - random_pos;
+        if(n > left) n = left;
+        memcpy(rand,&random_buffer[random_pos],n);
+        memset(&random_buffer[random_pos],0,n);
+        random_pos += n;
+        rand += n;
+        left -= n;
+    }
     return rand_length;
 #else
     problem("Libgcrypt not availaible in this system",NULL,NULL);
@@ -400,6 +615,49 @@ static int md_random(unsigned char *rand,int rand_length)
     
     
 
+/* format preserving token for TOKEN: digits are replaced by digits and letters
+ * by letters of same case, other characters are kept. Binary fields get random bytes.
+ */
+struct token_format {
+    int ftype;
+    uint8_t *original;
+    struct anon_field *a;
+};
+
+static void generate_token(uint8_t *token,int token_len,void *arg)
+{
+    struct token_format *t = (struct token_format *) arg;
+    register int i;
+    register uint8_t c;
+
+    md_random(token,token_len,t->a);
+
+    switch(t->ftype)
+    {
+        case F_ASC:
+        case F_BCD:
+        case F_COMP3:
+            for(i = 0;i < token_len;i++)
+            {
+                c = t->original[i];
+                if(c >= '0' && c <= '9')
+                {
+                    token[i] = '0' + token[i] % 10;
+                } else if(c >= 'A' && c <= 'Z')
+                {
+                    token[i] = 'A' + token[i] % 26;
+                } else if(c >= 'a' && c <= 'z')
+                {
+                    token[i] = 'a' + token[i] % 26;
+                } else
+                {
+                    token[i] = c;
+                }
+            }
+            break;
+    }
+}
+
 /* make scramble data based on anonymization info and normalized input data
  * scramble length is the length indicated byt start pos, length and actual data length
  * return scramble length
@@ -410,6 +668,7 @@ static int create_scramble(int ftype,uint8_t *scramble,int normalized_length,uin
     int scramble_length;
     int hash_length;
     static unsigned char hash[HASH_BUFFER_LEN]; 
+    struct token_format t;
 
     if(a->start >= 0)   // from beginning
     {
@@ -429,21 +688,28 @@ static int create_scramble(int ftype,uint8_t *scramble,int normalized_length,uin
             scramble_MASK(scramble,scramble_length,a->key_length > 0 ? a->key[0] : '0');
             break;
         case A_RANDOM:
-            hash_length = md_random(hash,scramble_length > HASH_BUFFER_LEN ? HASH_BUFFER_LEN : scramble_length);
+            hash_length = md_random(hash,scramble_length > HASH_BUFFER_LEN ? HASH_BUFFER_LEN : scramble_length,a);
             if(hash_length) scramble_HASH(ftype,hash_length,hash,scramble_length,scramble,NUM_ASCII_CHARS,crypt_ascii_chars); else scramble_length = 0;
             break;
         case A_NRANDOM:
-            hash_length = md_random(hash,scramble_length > HASH_BUFFER_LEN ? HASH_BUFFER_LEN : scramble_length);
+            hash_length = md_random(hash,scramble_length > HASH_BUFFER_LEN ? HASH_BUFFER_LEN : scramble_length,a);
             if(hash_length) scramble_HASH(ftype,hash_length,hash,scramble_length,scramble,NUM_NUMBER_CHARS,crypt_number_chars); else scramble_length = 0;
             break;
         case A_HASH:
-            hash_length = md_hash(hash,normalized_length,normalized_field,a->key_length > 0 ? atoi(a->key) : 16);
+            hash_length = md_hash(hash,normalized_length,normalized_field,a);
             if(hash_length) scramble_HASH(ftype,hash_length,hash,scramble_length,scramble,NUM_ASCII_CHARS,crypt_ascii_chars); else scramble_length = 0;
 	    break;
         case A_NHASH:
-            hash_length = md_hash(hash,normalized_length,normalized_field,a->key_length > 0 ? atoi(a->key) : 16);
+            hash_length = md_hash(hash,normalized_length,normalized_field,a);
             if(hash_length) scramble_HASH(ftype,hash_length,hash,scramble_length,scramble,NUM_NUMBER_CHARS,crypt_number_chars); else scramble_length = 0;
 	    break;
+        case A_TOKEN:
+            if(a->vault == NULL) a->vault = open_token_vault(a->vault_file);
+            t.ftype = ftype;
+            t.original = &normalized_field[a->start >= 0 ? a->start - 1 : normalized_length + a->start - scramble_length + 1];
+            t.a = a;
+            vault_token(a->vault,normalized_field,normalized_length,scramble,scramble_length,generate_token,&t);
+            break;
     }
     return scramble_length;
 }
@@ -474,9 +740,11 @@ void anonymize_fields(char *type,uint8_t quote,struct record *r,int len,uint8_t
 {
     static uint8_t normalized_field[MAX_NFIELD_LEN];
     static uint8_t scramble[MAX_NFIELD_LEN];
+    static uint8_t cache_key[MAX_NFIELD_LEN + 1];
     struct field *f = r->f;
     int normalized_length;
     int scramble_len;
+    uint8_t *cached;
 
     while(f != NULL)
     {
@@ -485,11 +753,26 @@ void anonymize_fields(char *type,uint8_t quote,struct record *r,int len,uint8_t
             normalized_length = get_normalized_field(f,type,quote,len,buffer,normalized_field);
             if(normalized_length)
             {
-                scramble_len = create_scramble(f->type,scramble,normalized_length,normalized_field,f->a);
-                if(scramble_len)
+                cached = NULL;
+                if(f->a->cache != NULL)  /* same value of same type gives always the same result */
+                {
+                    cache_key[0] = (uint8_t) f->type;
+                    memcpy(&cache_key[1],normalized_field,normalized_length);
+                    cached = value_cache_find(f->a->cache,cache_key,normalized_length + 1,NULL);
+                }
+
+                if(cached != NULL)
                 {
-                    scramble_normalized(scramble_len,scramble,normalized_length,normalized_field,f->a);
-                    write_scrambled_field(f,type,quote,buffer,normalized_length,normalized_field);
+                    write_scrambled_field(f,type,quote,buffer,normalized_length,cached);
+                } else
+                {
+                    scramble_len = create_scramble(f->type,scramble,normalized_length,normalized_field,f->a);
+                    if(scramble_len)
+                    {
+                        scramble_normalized(scramble_len,scramble,normalized_length,normalized_field,f->a);
+                        write_scrambled_field(f,type,quote,buffer,normalized_length,normalized_field);
+                        if(f->a->cache != NULL) value_cache_store(f->a->cache,cache_key,normalized_length + 1,normalized_field,normalized_length);
+                    }
                 }
             } 
         }
@@ -497,3 +780,20 @@ void anonymize_fields(char *type,uint8_t quote,struct record *r,int len,uint8_t
     }
 }
 
+/* print hit rates of anonymization caches */
+void print_anon_cache_stats()
+{
+    struct anon_field *a = anonymize;
+    struct value_cache *c;
+
+    while(a != NULL)
+    {
+        c = a->cache;
+        if(c != NULL && c->hits + c->misses)
+        {
+            fprintf(stderr,"%s: Anonymization '%s' field '%s' cache: %lu hits, %lu misses, hit rate %.1f%%\n",program,a->anon_name,a->field_name,
+                    c->hits,c->misses,100.0 * c->hits / (c->hits + c->misses));
+        }
+        a = a->next;
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Small direct mapped cache from field values to results, e.g. lookup values.
+ * An entry contains the key and the value in one buffer: key, 0, value, 0
+ * A new value replaces the entry having the same slot.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct value_cache *
+new_value_cache(size_t entries)
+{
+    struct value_cache *c = xmalloc(sizeof(struct value_cache));
+    size_t size = 1;
+
+    if(entries > MAX_CACHE_ENTRIES) entries = MAX_CACHE_ENTRIES;
+    while(size < entries) size *= 2;
+
+    c->size = size;
+    c->entries = xmalloc(size * sizeof(struct cache_entry));
+    memset(c->entries,0,size * sizeof(struct cache_entry));
+    c->hits = 0;
+    c->misses = 0;
+    c->probe = NULL;
+    c->probe_hash = 0;
+    c->memory = size * sizeof(struct cache_entry);
+    c->memory_limit = 0;
+    return c;
+}
+
+/* cache using at most bytes of memory for entries, keys and values.
+   Values which do not fit are not stored
+ */
+struct value_cache *
+new_value_cache_memory(size_t bytes)
+{
+    struct value_cache *c;
+    size_t entries = 1;
+
+    while(entries < MAX_CACHE_ENTRIES && 2 * entries * ANON_CACHE_ENTRY_SIZE <= bytes) entries *= 2;
+    c = new_value_cache(entries);
+    c->memory_limit = bytes;
+    return c;
+}
+
+/* returns the cached value for key, NULL if not found.
+   Value length is written to value_len.
+   After unsuccessful search the value can be stored with value_cache_store
+ */
+uint8_t *
+value_cache_find(struct value_cache *c,uint8_t *key,size_t len,size_t *value_len)
+{
+    register uint64_t h = string_hash(key,len,0);
+    register struct cache_entry *e = &c->entries[(size_t) h & (c->size - 1)];
+
+    if(e->data != NULL && e->hash == h && e->key_len == len && memcmp(e->data,key,len) == 0)
+    {
+        c->hits++;
+        if(value_len != NULL) *value_len = e->value_len;
+        return e->data + len + 1;
+    }
+
+    c->misses++;
+    c->probe = e;
+    c->probe_hash = h;
+    return NULL;
+}
+
+/* store value for key searched last time, returns pointer to the stored value.
+   If the memory limit would be exceeded nothing is stored and value is returned
+ */
+uint8_t *
+value_cache_store(struct value_cache *c,uint8_t *key,size_t len,uint8_t *value,size_t value_len)
+{
+    register struct cache_entry *e = c->probe;
+    size_t need = len + value_len + 2;
+
+    if(need > e->data_size)
+    {
+        if(c->memory_limit && c->memory - e->data_size + need > c->memory_limit) return value;
+        c->memory += need - e->data_size;
+        e->data_size = need;
+        e->data = xrealloc(e->data,need);
+    }
+
+    memcpy(e->data,key,len);
+    e->data[len] = 0;
+    memcpy(e->data + len + 1,value,value_len);
+    e->data[len + 1 + value_len] = 0;
+    e->hash = c->probe_hash;
+    e->key_len = len;
+    e->value_len = value_len;
+    return e->data + len + 1;
+}
@@ -0,0 +1,161 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Input code pages. A code page is a 256-byte table translating input
+ * bytes to ISO-8859-1. Built-in tables are used for common EBCDIC code
+ * pages, other single byte code pages are converted using iconv.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* IBM037, EBCDIC US/Canada */
+static uint8_t cp037[256] = {
+    0x00,0x01,0x02,0x03,0x9c,0x09,0x86,0x7f,0x97,0x8d,0x8e,0x0b,0x0c,0x0d,0x0e,0x0f,
+    0x10,0x11,0x12,0x13,0x9d,0x85,0x08,0x87,0x18,0x19,0x92,0x8f,0x1c,0x1d,0x1e,0x1f,
+    0x80,0x81,0x82,0x83,0x84,0x0a,0x17,0x1b,0x88,0x89,0x8a,0x8b,0x8c,0x05,0x06,0x07,
+    0x90,0x91,0x16,0x93,0x94,0x95,0x96,0x04,0x98,0x99,0x9a,0x9b,0x14,0x15,0x9e,0x1a,
+    0x20,0xa0,0xe2,0xe4,0xe0,0xe1,0xe3,0xe5,0xe7,0xf1,0xa2,0x2e,0x3c,0x28,0x2b,0x7c,
+    0x26,0xe9,0xea,0xeb,0xe8,0xed,0xee,0xef,0xec,0xdf,0x21,0x24,0x2a,0x29,0x3b,0xac,
+    0x2d,0x2f,0xc2,0xc4,0xc0,0xc1,0xc3,0xc5,0xc7,0xd1,0xa6,0x2c,0x25,0x5f,0x3e,0x3f,
+    0xf8,0xc9,0xca,0xcb,0xc8,0xcd,0xce,0xcf,0xcc,0x60,0x3a,0x23,0x40,0x27,0x3d,0x22,
+    0xd8,0x61,0x62,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0xab,0xbb,0xf0,0xfd,0xfe,0xb1,
+    0xb0,0x6a,0x6b,0x6c,0x6d,0x6e,0x6f,0x70,0x71,0x72,0xaa,0xba,0xe6,0xb8,0xc6,0xa4,
+    0xb5,0x7e,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0xa1,0xbf,0xd0,0xdd,0xde,0xae,
+    0x5e,0xa3,0xa5,0xb7,0xa9,0xa7,0xb6,0xbc,0xbd,0xbe,0x5b,0x5d,0xaf,0xa8,0xb4,0xd7,
+    0x7b,0x41,0x42,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0xad,0xf4,0xf6,0xf2,0xf3,0xf5,
+    0x7d,0x4a,0x4b,0x4c,0x4d,0x4e,0x4f,0x50,0x51,0x52,0xb9,0xfb,0xfc,0xf9,0xfa,0xff,
+    0x5c,0xf7,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0xb2,0xd4,0xd6,0xd2,0xd3,0xd5,
+    0x30,0x31,0x32,0x33,0x34,0x35,0x36,0x37,0x38,0x39,0xb3,0xdb,0xdc,0xd9,0xda,0x9f
+};
+
+/* IBM500, EBCDIC International */
+static uint8_t cp500[256] = {
+    0x00,0x01,0x02,0x03,0x9c,0x09,0x86,0x7f,0x97,0x8d,0x8e,0x0b,0x0c,0x0d,0x0e,0x0f,
+    0x10,0x11,0x12,0x13,0x9d,0x85,0x08,0x87,0x18,0x19,0x92,0x8f,0x1c,0x1d,0x1e,0x1f,
+    0x80,0x81,0x82,0x83,0x84,0x0a,0x17,0x1b,0x88,0x89,0x8a,0x8b,0x8c,0x05,0x06,0x07,
+    0x90,0x91,0x16,0x93,0x94,0x95,0x96,0x04,0x98,0x99,0x9a,0x9b,0x14,0x15,0x9e,0x1a,
+    0x20,0xa0,0xe2,0xe4,0xe0,0xe1,0xe3,0xe5,0xe7,0xf1,0x5b,0x2e,0x3c,0x28,0x2b,0x21,
+    0x26,0xe9,0xea,0xeb,0xe8,0xed,0xee,0xef,0xec,0xdf,0x5d,0x24,0x2a,0x29,0x3b,0x5e,
+    0x2d,0x2f,0xc2,0xc4,0xc0,0xc1,0xc3,0xc5,0xc7,0xd1,0xa6,0x2c,0x25,0x5f,0x3e,0x3f,
+    0xf8,0xc9,0xca,0xcb,0xc8,0xcd,0xce,0xcf,0xcc,0x60,0x3a,0x23,0x40,0x27,0x3d,0x22,
+    0xd8,0x61,0x62,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0xab,0xbb,0xf0,0xfd,0xfe,0xb1,
+    0xb0,0x6a,0x6b,0x6c,0x6d,0x6e,0x6f,0x70,0x71,0x72,0xaa,0xba,0xe6,0xb8,0xc6,0xa4,
+    0xb5,0x7e,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0xa1,0xbf,0xd0,0xdd,0xde,0xae,
+    0xa2,0xa3,0xa5,0xb7,0xa9,0xa7,0xb6,0xbc,0xbd,0xbe,0xac,0x7c,0xaf,0xa8,0xb4,0xd7,
+    0x7b,0x41,0x42,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0xad,0xf4,0xf6,0xf2,0xf3,0xf5,
+    0x7d,0x4a,0x4b,0x4c,0x4d,0x4e,0x4f,0x50,0x51,0x52,0xb9,0xfb,0xfc,0xf9,0xfa,0xff,
+    0x5c,0xf7,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0xb2,0xd4,0xd6,0xd2,0xd3,0xd5,
+    0x30,0x31,0x32,0x33,0x34,0x35,0x36,0x37,0x38,0x39,0xb3,0xdb,0xdc,0xd9,0xda,0x9f
+};
+
+static struct {
+    char *name;
+    uint8_t *table;
+} builtin_code_pages[] = {
+    {"ebcdic",cp037},
+    {"cp037",cp037},
+    {"ibm037",cp037},
+    {"cp500",cp500},
+    {"ibm500",cp500},
+    {NULL,NULL}
+};
+
+#ifdef HAVE_ICONV
+/* make the table using iconv, bytes not having ISO-8859-1 character are translated to '?' */
+static uint8_t *
+iconv_code_page(char *name)
+{
+    iconv_t cd = iconv_open("ISO-8859-1",name);
+    uint8_t *table;
+    char in,out,*inp,*outp;
+    size_t inleft,outleft;
+    int b;
+
+    if(cd == (iconv_t) -1) return NULL;
+
+    table = xmalloc(256);
+    for(b = 0;b < 256;b++)
+    {
+        in = (char) b;
+        inp = &in;
+        outp = &out;
+        inleft = 1;
+        outleft = 1;
+        iconv(cd,NULL,NULL,NULL,NULL);
+        if(iconv(cd,&inp,&inleft,&outp,&outleft) == (size_t) -1 || outleft)
+        {
+            table[b] = '?';
+        } else
+        {
+            table[b] = (uint8_t) out;
+        }
+    }
+    iconv_close(cd);
+    return table;
+}
+#endif
+
+/* returns the decoding table of code page name, NULL if the code page is unknown */
+uint8_t *
+code_page_table(char *name)
+{
+    int i = 0;
+
+    while(builtin_code_pages[i].name != NULL)
+    {
+        if(strcasecmp(builtin_code_pages[i].name,name) == 0) return builtin_code_pages[i].table;
+        i++;
+    }
+#ifdef HAVE_ICONV
+    return iconv_code_page(name);
+#else
+    return NULL;
+#endif
+}
+
+/* returns the encoding table of a decoding table. Characters not found in
+   the code page are kept as such */
+uint8_t *
+code_page_encoder(uint8_t *decode)
+{
+    uint8_t *encode = xmalloc(256);
+    int b;
+
+    for(b = 0;b < 256;b++) encode[b] = (uint8_t) b;
+    for(b = 255;b >= 0;b--) encode[decode[b]] = (uint8_t) b;    /* lowest byte wins */
+    return encode;
+}
+
+/* translate data in place using table */
+void
+translate(uint8_t *table,uint8_t *data,int len)
+{
+    register uint8_t *end = data + len;
+
+    while(data < end)
+    {
+        *data = table[*data];
+        data++;
+    }
+}
@@ -0,0 +1,1005 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Compiling a structure to C source (option --compile).
+ * The generated program prints one fixed length structure using one output.
+ * Record ids, field offsets and output texts are written to the code, so
+ * the program makes the same output as ffe without interpreting the rc-file.
+ * Features needing run time support from ffe (lookups, filters, formats,
+ * expressions, levels, anonymization...) cannot be compiled.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef PACKAGE_VERSION
+static char *version = PACKAGE_VERSION;
+#else
+static char *version = "0.2.5";
+#endif
+
+#define NUMBER_LEN 24     /* max length of a printed line number */
+
+/* generated statements writing one block of output and the maximum size of the block */
+struct code {
+    char *text;
+    size_t len;
+    size_t size;
+    uint8_t *lit;         /* constant text not yet written to statements */
+    size_t lit_len;
+    size_t lit_size;
+    char *target;         /* name of the write pointer in generated code */
+    char *indent;
+    size_t fixed;         /* bytes of constant texts, numbers and fields */
+    int names;            /* writes of the input file name */
+    int lines;            /* writes bounded by the input line length */
+    int start_used;       /* temporary pointer v is used */
+    int len_used;         /* line length is used */
+};
+
+/* runtime of the generated program */
+static char *runtime[] = {
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "#include <errno.h>",
+    "#include <ctype.h>",
+    "#include <stdint.h>",
+    "",
+    "#define BLOCK_SIZE 1048576",
+    "#define NUMBER_LEN 24",
+    "#define PUT(p,s,n) (memcpy((p),(s),(n)), (p) += (n))",
+    "",
+    "static char *program;",
+    "static char *file_name;",
+    "static size_t file_name_len;",
+    "static long file_lineno = 0;",
+    "static long total_lineno = 0;",
+    "static uint8_t *out,*op,*out_end;",
+    "static size_t out_size;",
+    "static uint8_t *work = NULL;",
+    "static size_t work_size = 0;",
+    "static uint8_t *input;",
+    "static size_t input_size;",
+    "",
+    "static void",
+    "panic(char *msg,char *info,char *syserror)",
+    "{",
+    "    if(op > out) fwrite(out,1,(size_t) (op - out),stdout);",
+    "    op = out;",
+    "    fflush(stdout);",
+    "    if(info == NULL && syserror == NULL)",
+    "    {",
+    "        fprintf(stderr,\"%s: %s\\n\",program,msg);",
+    "    } else if(info != NULL && syserror == NULL)",
+    "    {",
+    "        fprintf(stderr,\"%s: %s: %s\\n\",program,msg,info);",
+    "    } else if(info != NULL && syserror != NULL)",
+    "    {",
+    "        fprintf(stderr,\"%s: %s: %s; %s\\n\",program,msg,info,syserror);",
+    "    } else",
+    "    {",
+    "        fprintf(stderr,\"%s: %s; %s\\n\",program,msg,syserror);",
+    "    }",
+    "    exit(EXIT_FAILURE);",
+    "}",
+    "",
+    "static void *",
+    "xrealloc(void *ptr,size_t size)",
+    "{",
+    "    void *value = realloc(ptr,size);",
+    "    if(value == NULL) panic(\"Out of memory\",NULL,NULL);",
+    "    return value;",
+    "}",
+    "",
+    "static void",
+    "flush_output(void)",
+    "{",
+    "    size_t n = (size_t) (op - out);",
+    "",
+    "    op = out;",
+    "    if(n && fwrite(out,1,n,stdout) != n) panic(\"Error writing to\",\"(stdout)\",NULL);",
+    "}",
+    "",
+    "/* make room for n bytes after op */",
+    "static inline void",
+    "reserve_output(size_t n)",
+    "{",
+    "    if((size_t) (out_end - op) >= n) return;",
+    "    flush_output();",
+    "    if(n > out_size)",
+    "    {",
+    "        out_size = n + BLOCK_SIZE;",
+    "        out = xrealloc(out,out_size);",
+    "        op = out;",
+    "        out_end = out + out_size;",
+    "    }",
+    "}",
+    "",
+    "static inline uint8_t *",
+    "reserve_work(size_t n)",
+    "{",
+    "    if(n > work_size)",
+    "    {",
+    "        work_size = n + BLOCK_SIZE;",
+    "        work = xrealloc(work,work_size);",
+    "    }",
+    "    return work;",
+    "}",
+    "",
+    "static inline uint8_t *",
+    "put_number(uint8_t *p,long v)",
+    "{",
+    "    uint8_t b[NUMBER_LEN];",
+    "    int i = NUMBER_LEN;",
+    "",
+    "    do",
+    "    {",
+    "        b[--i] = (uint8_t) ('0' + v % 10);",
+    "        v /= 10;",
+    "    } while(v);",
+    "    memcpy(p,&b[i],NUMBER_LEN - i);",
+    "    return p + NUMBER_LEN - i;",
+    "}",
+    "",
+    "static inline uint8_t *",
+    "put_spaces(uint8_t *p,int n)",
+    "{",
+    "    memset(p,' ',n);",
+    "    return p + n;",
+    "}",
+    "",
+    "/* field ends at the first null byte like in ffe */",
+    "static inline uint8_t *",
+    "copy_field(uint8_t *p,uint8_t *data,int n)",
+    "{",
+    "    uint8_t *z = memchr(data,0,n);",
+    "",
+    "    if(z != NULL) n = (int) (z - data);",
+    "    memcpy(p,data,n);",
+    "    return p + n;",
+    "}",
+    "",
+    "static inline uint8_t *",
+    "trim_field(uint8_t *p,uint8_t *data,int n)",
+    "{",
+    "    uint8_t *start = p;",
+    "    int i = 0;",
+    "",
+    "    while(i < n && isblank(data[i])) i++;",
+    "    while(i < n && data[i]) *p++ = data[i++];",
+    "    if(p > start && isspace(p[-1]))",
+    "    {",
+    "        p--;",
+    "        while(p > start && isspace(*p)) p--;",
+    "        p++;",
+    "    }",
+    "    return p;",
+    "}",
+    "",
+    "static inline int",
+    "is_empty(uint8_t *s,uint8_t *e,char *empty_chars)",
+    "{",
+    "    while(s < e) if(strchr(empty_chars,*s++) == NULL) return 0;",
+    "    return 1;",
+    "}",
+    NULL
+};
+
+static char *reader[] = {
+    "static void",
+    "read_file(FILE *fp)",
+    "{",
+    "    size_t have = 0,pos = 0,n;",
+    "    uint8_t *lf;",
+    "    int eof = 0;",
+    "",
+    "    for(;;)",
+    "    {",
+    "        lf = memchr(input + pos,'\\n',have - pos);",
+    "        if(lf == NULL)",
+    "        {",
+    "            if(!eof)",
+    "            {",
+    "                have -= pos;",
+    "                memmove(input,input + pos,have);",
+    "                pos = 0;",
+    "                if(input_size - have < BLOCK_SIZE + 1)",
+    "                {",
+    "                    input_size = have + 2 * BLOCK_SIZE;",
+    "                    input = xrealloc(input,input_size);",
+    "                }",
+    "                n = fread(input + have,1,input_size - have - 1,fp);",
+    "                if(n == 0)",
+    "                {",
+    "                    if(ferror(fp)) panic(\"Error reading file\",file_name,strerror(errno));",
+    "                    eof = 1;",
+    "                }",
+    "                have += n;",
+    "                continue;",
+    "            }",
+    "            if(pos >= have) break;",
+    "            lf = input + have++;      /* add missing LF */",
+    "            *lf = '\\n';",
+    "        }",
+    "        select_record(input + pos,(int) (lf - input - pos));",
+    "        pos = (size_t) (lf - input) + 1;",
+    "    }",
+    "}",
+    "",
+    NULL
+};
+
+static void
+write_lines(FILE *fp,char **lines)
+{
+    while(*lines != NULL) fprintf(fp,"%s\n",*lines++);
+}
+
+static void
+code_init(struct code *c,char *target)
+{
+    c->text = NULL;
+    c->len = 0;
+    c->size = 0;
+    c->lit = NULL;
+    c->lit_len = 0;
+    c->lit_size = 0;
+    c->target = target;
+    c->indent = "    ";
+    c->fixed = 0;
+    c->names = 0;
+    c->lines = 0;
+    c->start_used = 0;
+    c->len_used = 0;
+}
+
+static void
+code_free(struct code *c)
+{
+    free(c->text);
+    free(c->lit);
+}
+
+static void
+code_append(struct code *c,char *text)
+{
+    size_t len = strlen(text);
+
+    if(c->len + len + 1 > c->size)
+    {
+        c->size = c->len + len + 1024;
+        c->text = xrealloc(c->text,c->size);
+    }
+    memcpy(c->text + c->len,text,len + 1);
+    c->len += len;
+}
+
+/* write bytes as C string literal, octal escapes are always three digits */
+static void
+code_string(struct code *c,uint8_t *s,size_t len)
+{
+    char esc[8];
+
+    code_append(c,"\"");
+    while(len--)
+    {
+        if(isprint(*s) && *s != '"' && *s != '\\' && *s != '?')
+        {
+            esc[0] = (char) *s;
+            esc[1] = 0;
+        } else
+        {
+            sprintf(esc,"\\%03o",(unsigned int) *s);
+        }
+        code_append(c,esc);
+        s++;
+    }
+    code_append(c,"\"");
+}
+
+static void
+flush_literal(struct code *c)
+{
+    char num[64];
+
+    if(!c->lit_len) return;
+    code_append(c,c->indent);
+    code_append(c,"PUT(");
+    code_append(c,c->target);
+    code_append(c,",");
+    code_string(c,c->lit,c->lit_len);
+    sprintf(num,",%lu);\n",(unsigned long) c->lit_len);
+    code_append(c,num);
+    c->fixed += c->lit_len;
+    c->lit_len = 0;
+}
+
+/* start a statement, pending constant text is written first */
+static void
+code_start(struct code *c)
+{
+    flush_literal(c);
+    code_append(c,c->indent);
+}
+
+static void
+code_line(struct code *c,char *text)
+{
+    code_start(c);
+    code_append(c,text);
+    code_append(c,"\n");
+}
+
+static void
+lit_char(struct code *c,uint8_t ch)
+{
+    if(c->lit_len == c->lit_size)
+    {
+        c->lit_size += 1024;
+        c->lit = xrealloc(c->lit,c->lit_size);
+    }
+    c->lit[c->lit_len++] = ch;
+}
+
+static void
+lit_string(struct code *c,uint8_t *s)
+{
+    if(s == NULL) return;
+    while(*s) lit_char(c,*s++);
+}
+
+static void
+file_name_code(struct code *c)
+{
+    char line[128];
+
+    sprintf(line,"PUT(%s,file_name,file_name_len);",c->target);
+    code_line(c,line);
+    c->names++;
+}
+
+static void
+number_code(struct code *c,char *variable)
+{
+    char line[128];
+
+    sprintf(line,"%s = put_number(%s,%s);",c->target,c->target,variable);
+    code_line(c,line);
+    c->fixed += NUMBER_LEN;
+}
+
+/* maximum size of the code output as C expression */
+static void
+size_expression(struct code *c,char *expr)
+{
+    expr += sprintf(expr,"%lu",(unsigned long) c->fixed);
+    if(c->names) expr += sprintf(expr," + %d * file_name_len",c->names);
+    if(c->lines) sprintf(expr," + %d * (size_t) len",c->lines);
+}
+
+/* code for print_text() */
+static void
+text_code(struct code *c,struct structure *s,struct record *r,uint8_t *text)
+{
+    if(text == NULL) return;
+
+    while(*text)
+    {
+        if(*text == '%' && text[1])
+        {
+            text++;
+            switch(*text)
+            {
+                case 'f':
+                    file_name_code(c);
+                    break;
+                case 's':
+                    lit_string(c,s->name);
+                    break;
+                case 'r':
+                    if(r != NULL) lit_string(c,r->name);
+                    break;
+                case 'o':
+                    number_code(c,"file_lineno");
+                    break;
+                case 'O':
+                    number_code(c,"total_lineno");
+                    break;
+                case 'I':
+                case 'i':
+                    lit_char(c,'0');    /* offsets are counted only for binary input */
+                    break;
+                case 'g':
+                case 'n':
+                    break;              /* no levels */
+                case '%':
+                    lit_char(c,'%');
+                    break;
+                default:
+                    lit_char(c,'%');
+                    lit_char(c,*text);
+                    break;
+            }
+        } else
+        {
+            lit_char(c,*text);
+        }
+        text++;
+    }
+}
+
+/* code for print_fixed_field(), k is the index of the field in record */
+static void
+directive_code(struct code *c,struct record *r,struct output *o,struct field *f,uint8_t format,int k)
+{
+    char line[256];
+    char guard[64];
+    uint8_t *data;
+    int i,empty;
+
+    if(f->const_data != NULL)
+    {
+        data = f->const_data;
+        i = 0;
+        empty = 1;
+        while((!f->length || i < f->length) && data[i] != '\n' && data[i])
+        {
+            if(format != 'e') lit_char(c,data[i]);
+            if(strchr(o->empty_chars,data[i]) == NULL) empty = 0;
+            i++;
+        }
+        if(!o->print_empty && !empty)
+        {
+            sprintf(line,"empty[%d] = 0;",k);
+            code_line(c,line);
+        }
+        return;
+    }
+
+    if(format == 'e' && o->print_empty) return;     /* nothing is written */
+
+    guard[0] = 0;
+    if(r->arb_length == RL_MIN && f->next == NULL)
+    {
+        sprintf(guard,"if(len > %d) ",f->position);
+        c->len_used = 1;
+    }
+
+    if(!o->print_empty || format == 'e')
+    {
+        sprintf(line,"v = %s;",c->target);
+        code_line(c,line);
+        c->start_used = 1;
+    }
+
+    code_start(c);
+    code_append(c,guard);
+    if(f->length)
+    {
+        sprintf(line,"%s = %s(%s,l + %d,%d);\n",c->target,format == 't' ? "trim_field" : "copy_field",c->target,f->position,f->length);
+        c->fixed += f->length;
+    } else
+    {
+        sprintf(line,"%s = %s(%s,l + %d,len - %d);\n",c->target,format == 't' ? "trim_field" : "copy_field",c->target,f->position,f->position);
+        c->lines++;
+        c->len_used = 1;
+    }
+    code_append(c,line);
+
+    if(!o->print_empty)
+    {
+        code_start(c);
+        sprintf(line,"if(empty[%d] && !is_empty(v,%s,",k,c->target);
+        code_append(c,line);
+        code_string(c,o->empty_chars,strlen(o->empty_chars));
+        sprintf(line,")) empty[%d] = 0;\n",k);
+        code_append(c,line);
+    }
+
+    if(format == 'e')
+    {
+        sprintf(line,"%s = v;",c->target);
+        code_line(c,line);
+    }
+}
+
+/* code for the first pass of print_fields(), data of one field */
+static void
+field_code(struct code *c,struct structure *s,struct record *r,struct output *o,struct field *f,int k,int generic)
+{
+    uint8_t *d = o->data;
+    char line[128];
+    int justify_set = 0;
+    int i;
+
+    if(generic)
+    {
+        sprintf(line,"fs[%d] = %s;",k,c->target);
+        code_line(c,line);
+        if(!o->print_empty)
+        {
+            sprintf(line,"empty[%d] = 1;",k);
+            code_line(c,line);
+        }
+    }
+
+    while(*d)
+    {
+        if(generic && o->justify == *d && o->justify != LEFT_JUSTIFY && o->justify != RIGHT_JUSTIFY && !justify_set)
+        {
+            sprintf(line,"j[%d] = (int) (%s - fs[%d]);",k,c->target,k);
+            code_line(c,line);
+            justify_set = 1;
+        }
+
+        if(*d == '%')
+        {
+            d++;
+            switch(*d)
+            {
+                case 0:
+                    lit_char(c,'%');
+                    d--;
+                    break;
+                case 'f':
+                    file_name_code(c);
+                    break;
+                case 's':
+                    lit_string(c,s->name);
+                    break;
+                case 'r':
+                    lit_string(c,r->name);
+                    break;
+                case 'o':
+                    number_code(c,"file_lineno");
+                    break;
+                case 'O':
+                    number_code(c,"total_lineno");
+                    break;
+                case 'I':
+                case 'i':
+                    lit_char(c,'0');
+                    break;
+                case 'p':
+                    if(f->const_data == NULL)
+                    {
+                        sprintf(line,"%d",f->position + 1);
+                        lit_string(c,line);
+                    }
+                    break;
+                case '%':
+                    lit_char(c,'%');
+                    break;
+                case 'n':
+                    lit_string(c,f->name);
+                    break;
+                case 'l':
+                    break;              /* no lookup, value is empty */
+                case 'L':
+                    for(i = 0;i < f->length;i++) lit_char(c,' ');
+                    break;
+                case 'h':
+                    break;
+                case 'd':
+                case 't':
+                case 'D':
+                case 'C':
+                case 'e':
+                case 'x':
+                    directive_code(c,r,o,f,*d,k);
+                    break;
+                default:
+                    lit_char(c,'%');
+                    lit_char(c,*d);
+                    break;
+            }
+        } else
+        {
+            lit_char(c,*d);
+        }
+        d++;
+    }
+
+    if(generic)
+    {
+        if(o->justify != LEFT_JUSTIFY && (o->justify == RIGHT_JUSTIFY || !justify_set))
+        {
+            if(o->justify == RIGHT_JUSTIFY)
+            {
+                sprintf(line,"j[%d] = (int) (%s - fs[%d]);",k,c->target,k);
+            } else
+            {
+                sprintf(line,"j[%d] = -1;",k);
+            }
+            code_line(c,line);
+        }
+        sprintf(line,"fe[%d] = %s;",k,c->target);
+        code_line(c,line);
+    }
+}
+
+/* code for print_header() */
+static void
+header_code(struct code *c,struct record *r)
+{
+    struct print_field *pf = r->pf;
+    uint8_t *text;
+
+    code_line(c,"if(!header_printed)");
+    code_line(c,"{");
+    c->indent = "        ";
+    while(pf != NULL)
+    {
+        text = r->o->header;
+        while(*text)
+        {
+            if(*text == '%' && text[1])
+            {
+                text++;
+                if(*text == 'n')
+                {
+                    lit_string(c,pf->f->name);
+                } else
+                {
+                    lit_char(c,'%');
+                    lit_char(c,*text);
+                }
+            } else
+            {
+                lit_char(c,*text);
+            }
+            text++;
+        }
+        if(pf->next != NULL) lit_string(c,r->o->separator);
+        pf = pf->next;
+    }
+    lit_string(c,r->o->record_trailer);
+    code_line(c,"header_printed = 1;");
+    c->indent = "    ";
+    code_line(c,"}");
+}
+
+static void
+record_code(FILE *fp,struct structure *s,struct record *r,int index)
+{
+    struct output *o = r->o;
+    struct print_field *pf;
+    struct code fields,body;
+    char line[256];
+    int n = r->pf_count,k;
+    int text_ok = s->o != no_output && s->o != raw;
+    int generic = !o->print_empty || o->justify != LEFT_JUSTIFY || o->indent != NULL;
+
+    fprintf(fp,"\n/* record %s */\nstatic void\nprint_record_%d(uint8_t *l,int len)\n{\n",r->name,index);
+
+    if(o == raw)
+    {
+        fprintf(fp,"    reserve_output((size_t) len + 1);\n    PUT(op,l,len);\n    *op++ = '\\n';\n}\n");
+        return;
+    }
+
+    code_init(&fields,"w");
+    code_init(&body,"p");
+
+    if(!generic) /* fields are written directly to output */
+    {
+        if(o->header != NULL && n) header_code(&body,r);
+        if(text_ok) text_code(&body,s,r,o->record_header);
+        for(pf = r->pf,k = 0;pf != NULL;pf = pf->next,k++)
+        {
+            field_code(&body,s,r,o,pf->f,k,0);
+            if(pf->next != NULL) lit_string(&body,o->separator);
+        }
+        if(text_ok) text_code(&body,s,r,o->record_trailer);
+        flush_literal(&body);
+
+        fprintf(fp,"    uint8_t *p%s;\n\n",body.start_used ? ",*v" : "");
+        if(!body.len_used) fprintf(fp,"    (void) len;\n");
+        size_expression(&body,line);
+        fprintf(fp,"    reserve_output(%s);\n    p = op;\n%s    op = p;\n}\n",line,body.text != NULL ? body.text : "");
+        code_free(&body);
+        code_free(&fields);
+        return;
+    }
+
+    for(pf = r->pf,k = 0;pf != NULL;pf = pf->next,k++) field_code(&fields,s,r,o,pf->f,k,1);
+    flush_literal(&fields);
+
+    if(o->header != NULL && n) header_code(&body,r);
+    if(o->indent != NULL && o->record_header != NULL) lit_string(&body,o->indent);
+    if(text_ok) text_code(&body,s,r,o->record_header);
+    if(n)
+    {
+        if(!o->print_empty)
+        {
+            code_line(&body,"if(count)");
+            code_line(&body,"{");
+            body.indent = "        ";
+        }
+        for(pf = r->pf,k = 0;pf != NULL;pf = pf->next,k++)
+        {
+            if(!o->print_empty)
+            {
+                sprintf(line,"if(!empty[%d])",k);
+                code_line(&body,line);
+                code_line(&body,"{");
+                body.indent = "            ";
+            }
+            if(o->indent != NULL)
+            {
+                lit_string(&body,o->indent);
+                lit_string(&body,o->indent);
+            }
+            if(o->justify != LEFT_JUSTIFY)
+            {
+                sprintf(line,"if(j[%d] > -1) p = put_spaces(p,maxj - j[%d]);",k,k);
+                code_line(&body,line);
+            }
+            sprintf(line,"PUT(p,fs[%d],fe[%d] - fs[%d]);",k,k,k);
+            code_line(&body,line);
+            if(!o->print_empty)
+            {
+                body.indent = "        ";
+                code_line(&body,"}");
+            }
+            if(pf->next != NULL) lit_string(&body,o->separator);
+        }
+        if(!o->print_empty)
+        {
+            body.indent = "    ";
+            code_line(&body,"}");
+        }
+    }
+    if(o->print_empty || n)
+    {
+        if(!o->print_empty)
+        {
+            code_line(&body,"if(count)");
+            code_line(&body,"{");
+            body.indent = "        ";
+        }
+        if(o->indent != NULL && o->record_trailer != NULL) lit_string(&body,o->indent);
+        if(text_ok) text_code(&body,s,r,o->record_trailer);
+        if(!o->print_empty)
+        {
+            body.indent = "    ";
+            code_line(&body,"}");
+        }
+    }
+    flush_literal(&body);
+
+    fprintf(fp,"    uint8_t *p,*w%s;\n",fields.start_used ? ",*v" : "");
+    if(n)
+    {
+        fprintf(fp,"    uint8_t *fs[%d],*fe[%d];\n",n,n);
+        if(o->justify != LEFT_JUSTIFY) fprintf(fp,"    int j[%d],maxj = 0;\n",n);
+        if(!o->print_empty) fprintf(fp,"    int empty[%d],count;\n",n);
+    }
+    fprintf(fp,"\n");
+    if(!fields.len_used && !body.len_used) fprintf(fp,"    (void) len;\n");
+    size_expression(&fields,line);
+    fprintf(fp,"    w = reserve_work(%s);\n%s",line,fields.text != NULL ? fields.text : "");
+    if(n && o->justify != LEFT_JUSTIFY)
+    {
+        for(k = 0;k < n;k++) fprintf(fp,"    if(j[%d] > maxj) maxj = j[%d];\n",k,k);
+    }
+    if(n && !o->print_empty)
+    {
+        fprintf(fp,"    count = 0;\n");
+        for(k = 0;k < n;k++) fprintf(fp,"    if(!empty[%d]) count++;\n",k);
+    }
+    size_expression(&body,line);
+    fprintf(fp,"    reserve_output(%s + (size_t) (w - work)",line);
+    if(n && o->justify != LEFT_JUSTIFY) fprintf(fp," + %d * (size_t) maxj",n);
+    fprintf(fp,");\n    p = op;\n%s    op = p;\n}\n",body.text != NULL ? body.text : "");
+    code_free(&body);
+    code_free(&fields);
+}
+
+/* condition selecting the record as in vote_record() */
+static void
+select_code(FILE *fp,struct record *r)
+{
+    struct id *i = r->i;
+    int terms = 0;
+    int length;
+    struct code key;
+
+    if(r->arb_length == RL_STRICT)
+    {
+        fprintf(fp,"len == %d",r->length);
+        terms++;
+    } else if(r->length > 0)
+    {
+        fprintf(fp,"len >= %d",r->length);
+        terms++;
+    }
+
+    while(i != NULL)
+    {
+        length = strlen(i->key) + 1;   /* keys are compared with strncmp */
+        if(length > i->length) length = i->length;
+        if(length > 0)
+        {
+            if(r->length < i->position - 1 + length)
+            {
+                fprintf(fp,"%slen >= %d",terms++ ? " && " : "",i->position - 1 + length);
+            }
+            if(length == 1)
+            {
+                fprintf(fp,"%sl[%d] == 0x%02x",terms++ ? " && " : "",i->position - 1,(unsigned int) i->key[0]);
+            } else
+            {
+                code_init(&key,"");
+                code_string(&key,i->key,length);
+                fprintf(fp,"%smemcmp(l + %d,%s,%d) == 0",terms++ ? " && " : "",i->position - 1,key.text,length);
+                code_free(&key);
+            }
+        }
+        i = i->next;
+    }
+    if(!terms) fprintf(fp,"1");
+}
+
+static void
+check_compile(struct structure *s)
+{
+    struct record *r;
+    struct print_field *pf;
+    struct field *f;
+    struct id *i;
+
+    if(s->type[0] != FIXED_LENGTH) panic("Only fixed length structures can be compiled, structure",s->name,NULL);
+    if(s->decode != NULL) panic("Structure having a code page cannot be compiled",s->name,NULL);
+    if(s->framing != FRAME_LF) panic("Structure having a record length cannot be compiled",s->name,NULL);
+    if(expression != NULL || expression_tree != NULL) panic("Expressions cannot be used with --compile",NULL,NULL);
+    if(s->o->ofp != NULL) panic("Output having an output file cannot be compiled",s->o->name,NULL);
+
+    r = s->r;
+    while(r != NULL)
+    {
+        if(r->level != NULL) panic("Record having a level cannot be compiled",r->name,NULL);
+        if(r->length_field != NULL) panic("Record having a length field cannot be compiled",r->name,NULL);
+        if(r->o->ofp != NULL) panic("Output having an output file cannot be compiled",r->o->name,NULL);
+
+        i = r->i;
+        while(i != NULL)
+        {
+            if(i->regexp) panic("Regular expression ids cannot be compiled, record",r->name,NULL);
+            i = i->next;
+        }
+
+        if(r->o != no_output && r->o != raw)
+        {
+            pf = r->pf;
+            while(pf != NULL)
+            {
+                f = pf->f;
+                if(f->lookup != NULL) panic("Field having a lookup cannot be compiled",f->name,NULL);
+                if(f->p != NULL) panic("Field having a filter cannot be compiled",f->name,NULL);
+                if(f->f != NULL) panic("Field having a format cannot be compiled",f->name,NULL);
+                if(f->o != NULL) panic("Field having an output cannot be compiled",f->name,NULL);
+                if(f->rep != NULL) panic("Replaced field cannot be compiled",f->name,NULL);
+                pf = pf->next;
+            }
+        }
+        r = r->next;
+    }
+}
+
+/* write C source of a program printing structure s with its output to file */
+void
+compile_structure(struct structure *s,int strict,char *file)
+{
+    FILE *fp;
+    struct record *r;
+    struct code file_header,file_trailer;
+    char line[256];
+    int index;
+    int text_ok = s->o != no_output && s->o != raw;
+    int trailer = text_ok && s->o->file_trailer != NULL;
+    int header = 0;
+
+    init_structure(s,NULL,0,NULL);
+    check_compile(s);
+
+    fp = file != NULL ? xfopen(file,"w") : stdout;
+
+    fprintf(fp,"/* Extractor for structure \"%s\" using output \"%s\",\n",s->name,s->o->name);
+    fprintf(fp,"   generated by ffe %s with option --compile.\n",version);
+    fprintf(fp,"   Reads the files given as arguments or standard input and writes to standard output. */\n\n");
+    write_lines(fp,runtime);
+
+    for(r = s->r;r != NULL;r = r->next)
+    {
+        if(r->o != no_output && r->o != raw && r->o->header != NULL && r->pf != NULL) header = 1;
+    }
+    if(header) fprintf(fp,"\nstatic int header_printed = 0;\n");
+    if(trailer) fprintf(fp,"\nstatic int quiet = 0;            /* last record is not printed as text */\n");
+
+    for(r = s->r,index = 0;r != NULL;r = r->next,index++)
+    {
+        if(r->o != no_output && (r->o == raw || r->pf != NULL || r->o->no_data)) record_code(fp,s,r,index);
+    }
+
+    fprintf(fp,"\nstatic void\nselect_record(uint8_t *l,int len)\n{\n    file_lineno++;\n    total_lineno++;\n");
+    for(r = s->r,index = 0;r != NULL;r = r->next,index++)
+    {
+        fprintf(fp,"    if(");
+        select_code(fp,r);
+        fprintf(fp,")\n    {\n");
+        if(r->o != no_output && (r->o == raw || r->pf != NULL || r->o->no_data)) fprintf(fp,"        print_record_%d(l,len);\n",index);
+        if(trailer) fprintf(fp,"        quiet = %d;\n",r->o == no_output || r->o == raw);
+        fprintf(fp,"        return;\n    }\n");
+    }
+    if(trailer) fprintf(fp,"    quiet = 0;\n");
+    fprintf(fp,"    fprintf(stderr,\"%%s: Invalid input line in file \\'%%s\\', line %%ld, line length = %%d\\n\",program,file_name,file_lineno,len);\n");
+    if(strict) fprintf(fp,"    panic(\"Using option -l does not cause program to abort in case of invalid input\",NULL,NULL);\n");
+    fprintf(fp,"}\n\n");
+
+    write_lines(fp,reader);
+
+    code_init(&file_header,"p");
+    if(text_ok) text_code(&file_header,s,NULL,s->o->file_header);
+    flush_literal(&file_header);
+    code_init(&file_trailer,"p");
+    file_trailer.indent = "        ";
+    if(trailer) text_code(&file_trailer,s,NULL,s->o->file_trailer);
+    flush_literal(&file_trailer);
+
+    fprintf(fp,"int\nmain(int argc,char **argv)\n{\n    FILE *fp;\n    int i = 1;\n");
+    if(file_header.text != NULL || file_trailer.text != NULL) fprintf(fp,"    uint8_t *p;\n");
+    fprintf(fp,"\n    program = argv[0];\n");
+    fprintf(fp,"    out_size = BLOCK_SIZE;\n    out = xrealloc(NULL,out_size);\n    op = out;\n    out_end = out + out_size;\n");
+    fprintf(fp,"    input_size = 2 * BLOCK_SIZE;\n    input = xrealloc(NULL,input_size);\n\n");
+    fprintf(fp,"    file_name = argc < 2 || strcmp(argv[1],\"-\") == 0 ? \"(stdin)\" : argv[1];\n");
+    fprintf(fp,"    file_name_len = strlen(file_name);\n");
+    if(file_header.text != NULL)
+    {
+        size_expression(&file_header,line);
+        fprintf(fp,"    reserve_output(%s);\n    p = op;\n%s    op = p;\n",line,file_header.text);
+    }
+    code_free(&file_header);
+
+    fprintf(fp,"\n    do\n    {\n");
+    fprintf(fp,"        if(i >= argc || strcmp(argv[i],\"-\") == 0)\n        {\n            fp = stdin;\n            file_name = \"(stdin)\";\n");
+    fprintf(fp,"        } else\n        {\n            fp = fopen(argv[i],\"r\");\n");
+    fprintf(fp,"            if(fp == NULL) panic(\"Error in opening file\",argv[i],strerror(errno));\n            file_name = argv[i];\n        }\n");
+    fprintf(fp,"        file_name_len = strlen(file_name);\n        file_lineno = 0;\n        read_file(fp);\n");
+    fprintf(fp,"        if(fp != stdin) fclose(fp);\n        i++;\n    } while(i < argc);\n\n");
+
+    if(file_trailer.text != NULL)
+    {
+        size_expression(&file_trailer,line);
+        fprintf(fp,"    if(!quiet)\n    {\n        reserve_output(%s);\n        p = op;\n%s        op = p;\n    }\n",line,file_trailer.text);
+    }
+    code_free(&file_trailer);
+
+    fprintf(fp,"    flush_output();\n");
+    fprintf(fp,"    if(fclose(stdout) != 0) panic(\"Error closing file\",\"(stdout)\",strerror(errno));\n");
+    fprintf(fp,"    return EXIT_SUCCESS;\n}\n");
+
+    if(fp != stdout && fclose(fp) != 0) panic("Error closing file",file,strerror(errno));
+}
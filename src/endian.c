@@ -30,6 +30,10 @@
 #include <string.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define LONG_INT 0x0a0b0c0d
 
 uint8_t be[4]={0x0a,0x0b,0x0c,0x0d};
@@ -55,88 +59,63 @@ check_system_endianess()
     return F_UNKNOWN_ENDIAN;
 }
 
-/* Endian change functions, s = source 
-   returns pointer to aligned and converted number
+/* Endian change functions, s = source
+   returns pointer to aligned and converted number.
+   Source can be unaligned, it is read with memcpy.
 */
 
-inline uint8_t *
-betole_16(uint8_t *s)
+static uint8_t *
+swap_16(uint8_t *s)
 {
-    target[0] = s[1];
-    target[1] = s[0];
+    uint16_t v;
+
+    memcpy(&v,s,2);
+    v = BSWAP16(v);
+    memcpy(target,&v,2);
     return target;
 }
 
-inline uint8_t *
-letobe_16(uint8_t *s)
+static uint8_t *
+swap_32(uint8_t *s)
 {
-    return betole_16(s);
-}
+    uint32_t v;
 
-inline uint8_t *
-betole_32(uint8_t *s)
-{
-    target[0] = s[3];
-    target[1] = s[2];
-    target[2] = s[1];
-    target[3] = s[0];
+    memcpy(&v,s,4);
+    v = BSWAP32(v);
+    memcpy(target,&v,4);
     return target;
 }
 
-inline uint8_t *
-letobe_32(uint8_t *s)
+static uint8_t *
+swap_64(uint8_t *s)
 {
-    return betole_32(s);
-}
+    uint64_t v;
 
-inline uint8_t *
-betole_64(uint8_t *s)
-{
-    target[0] = s[7];
-    target[1] = s[6];
-    target[2] = s[5];
-    target[3] = s[4];
-    target[4] = s[3];
-    target[5] = s[2];
-    target[6] = s[1];
-    target[7] = s[0];
+    memcpy(&v,s,8);
+    v = BSWAP64(v);
+    memcpy(target,&v,8);
     return target;
 }
 
-inline uint8_t *
-letobe_64(uint8_t *s)
+static uint8_t *
+swap_128(uint8_t *s)
 {
-    return betole_64(s);
-}
+    uint64_t h,l;
 
-inline uint8_t *
-betole_128(uint8_t *s)
-{
-    target[0] = s[15];
-    target[1] = s[14];
-    target[2] = s[13];
-    target[3] = s[12];
-    target[4] = s[11];
-    target[5] = s[10];
-    target[6] = s[9];
-    target[7] = s[8];
-    target[8] = s[7];
-    target[9] = s[6];
-    target[10] = s[5];
-    target[11] = s[4];
-    target[12] = s[3];
-    target[13] = s[2];
-    target[14] = s[1];
-    target[15] = s[0];
+    memcpy(&h,s,8);
+    memcpy(&l,s + 8,8);
+    h = BSWAP64(h);
+    l = BSWAP64(l);
+    memcpy(target,&l,8);
+    memcpy(target + 8,&h,8);
     return target;
 }
 
-
-inline uint8_t *
-letobe_128(uint8_t *s)
-{
-    return betole_128(s);
-}
+/* swap functions by number of bytes */
+static uint8_t *(*swap[17])(uint8_t *) = {
+    NULL,NULL,swap_16,NULL,swap_32,NULL,NULL,NULL,swap_64,
+    NULL,NULL,NULL,NULL,NULL,NULL,NULL,swap_128
+};
 
 uint8_t *
 endian_and_align(uint8_t *s,int t_endian, int s_endian, int bytes)
@@ -152,16 +131,155 @@ endian_and_align(uint8_t *s,int t_endian, int s_endian, int bytes)
         return target;
     }
 
-    if(t_endian == F_BIG_ENDIAN && s_endian == F_LITTLE_ENDIAN && bytes == 2) return letobe_16(s);
-    if(t_endian == F_LITTLE_ENDIAN && s_endian == F_BIG_ENDIAN && bytes == 2) return betole_16(s);
-    if(t_endian == F_BIG_ENDIAN && s_endian == F_LITTLE_ENDIAN && bytes == 4) return letobe_32(s);
-    if(t_endian == F_LITTLE_ENDIAN && s_endian == F_BIG_ENDIAN && bytes == 4) return betole_32(s);
-    if(t_endian == F_BIG_ENDIAN && s_endian == F_LITTLE_ENDIAN && bytes == 8) return letobe_64(s);
-    if(t_endian == F_LITTLE_ENDIAN && s_endian == F_BIG_ENDIAN && bytes == 8) return betole_64(s);
-    if(t_endian == F_BIG_ENDIAN && s_endian == F_LITTLE_ENDIAN && bytes == 16) return letobe_128(s);
-    if(t_endian == F_LITTLE_ENDIAN && s_endian == F_BIG_ENDIAN && bytes == 16) return betole_128(s);
+    if(bytes <= 16 && swap[bytes] != NULL &&
+       (t_endian == F_BIG_ENDIAN || t_endian == F_LITTLE_ENDIAN) &&
+       (s_endian == F_BIG_ENDIAN || s_endian == F_LITTLE_ENDIAN)) return swap[bytes](s);
+
     fprintf(stderr,"%d %d %d\n",s_endian,t_endian,bytes);
     panic("Internal endian error",NULL,NULL);
     return NULL;
 }
 
+/* BCD and hex fields are expanded to text using tables having both
+ * characters of a byte. Nibble 0xf ends a BCD number, table bcd_count has the
+ * number of characters a byte gives before the end.
+ */
+static uint8_t digit_pairs[2][2][256][2];   /* [caps][little endian][byte] */
+static uint8_t bcd_count[2][256];           /* [little endian][byte] */
+static int digit_pairs_ready = 0;
+
+static void
+init_digit_pairs()
+{
+    static char *digits[2] = {"0123456789abcdef","0123456789ABCDEF"};
+    int caps,b,hi,lo;
+
+    for(b = 0;b < 256;b++)
+    {
+        hi = b >> 4;
+        lo = b & 0x0f;
+        for(caps = 0;caps < 2;caps++)
+        {
+            digit_pairs[caps][0][b][0] = digits[caps][hi];
+            digit_pairs[caps][0][b][1] = digits[caps][lo];
+            digit_pairs[caps][1][b][0] = digits[caps][lo];
+            digit_pairs[caps][1][b][1] = digits[caps][hi];
+        }
+        bcd_count[0][b] = hi == 0x0f ? 0 : (lo == 0x0f ? 1 : 2);
+        bcd_count[1][b] = lo == 0x0f ? 0 : (hi == 0x0f ? 1 : 2);
+    }
+    digit_pairs_ready = 1;
+}
+
+#if defined(__SSE2__)
+/* expand 16 bytes to 32 characters, nibbles of a byte are swapped if little is set.
+   If bcd is set and the data contains nibble 0xf nothing is written and 0 is returned */
+static int
+expand_16(uint8_t *out,uint8_t *data,int little,int caps,int bcd)
+{
+    __m128i v = _mm_loadu_si128((__m128i *) data);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v,4),mask);
+    __m128i lo = _mm_and_si128(v,mask);
+    __m128i n1 = little ? _mm_unpacklo_epi8(lo,hi) : _mm_unpacklo_epi8(hi,lo);
+    __m128i n2 = little ? _mm_unpackhi_epi8(lo,hi) : _mm_unpackhi_epi8(hi,lo);
+    __m128i nine = _mm_set1_epi8(9);
+    __m128i zero = _mm_set1_epi8('0');
+    __m128i letter = _mm_set1_epi8((caps ? 'A' : 'a') - '0' - 10);
+
+    if(bcd && _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(n1,mask),_mm_cmpeq_epi8(n2,mask)))) return 0;
+
+    n1 = _mm_add_epi8(_mm_add_epi8(n1,zero),_mm_and_si128(_mm_cmpgt_epi8(n1,nine),letter));
+    n2 = _mm_add_epi8(_mm_add_epi8(n2,zero),_mm_and_si128(_mm_cmpgt_epi8(n2,nine),letter));
+    _mm_storeu_si128((__m128i *) out,n1);
+    _mm_storeu_si128((__m128i *) (out + 16),n2);
+    return 1;
+}
+#endif
+
+/* expand packed BCD number to text, nibble 0xf ends the number.
+   out must have room for 2 * length characters, returns the text length */
+int
+bcd_expand(uint8_t *out,uint8_t *data,int length,int endianess,int caps)
+{
+    register uint8_t *o = out;
+    register uint8_t *end = data + length;
+    uint8_t (*pairs)[2];
+    uint8_t *count;
+    int little,n;
+
+    if(endianess != F_BIG_ENDIAN && endianess != F_LITTLE_ENDIAN) return 0;
+    if(!digit_pairs_ready) init_digit_pairs();
+
+    little = endianess == F_LITTLE_ENDIAN;
+    caps = caps ? 1 : 0;
+
+#if defined(__SSE2__)
+    while(end - data >= 16 && expand_16(o,data,little,caps,1))
+    {
+        o += 32;
+        data += 16;
+    }
+#endif
+
+    pairs = digit_pairs[caps][little];
+    count = bcd_count[little];
+
+    while(data < end)
+    {
+        n = count[*data];
+        o[0] = pairs[*data][0];
+        o[1] = pairs[*data][1];
+        o += n;
+        if(n < 2) break;
+        data++;
+    }
+    return (int) (o - out);
+}
+
+/* expand hex field to text, little endian data is printed starting from the last byte.
+   out must have room for 2 * length characters, returns the text length */
+int
+hex_expand(uint8_t *out,uint8_t *data,int length,int endianess,int caps)
+{
+    register uint8_t *o = out;
+    register uint8_t *p;
+    uint8_t (*pairs)[2];
+
+    if(endianess != F_BIG_ENDIAN && endianess != F_LITTLE_ENDIAN) return 0;
+    if(!digit_pairs_ready) init_digit_pairs();
+
+    caps = caps ? 1 : 0;
+    pairs = digit_pairs[caps][0];
+
+    if(endianess == F_LITTLE_ENDIAN)
+    {
+        p = data + length;
+        while(p > data)
+        {
+            p--;
+            o[0] = pairs[*p][0];
+            o[1] = pairs[*p][1];
+            o += 2;
+        }
+    } else
+    {
+        p = data;
+#if defined(__SSE2__)
+        while(data + length - p >= 16)
+        {
+            expand_16(o,p,0,caps,0);
+            o += 32;
+            p += 16;
+        }
+#endif
+        while(p < data + length)
+        {
+            o[0] = pairs[*p][0];
+            o[1] = pairs[*p][1];
+            o += 2;
+            p++;
+        }
+    }
+    return (int) (o - out);
+}
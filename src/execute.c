@@ -30,6 +30,18 @@
 #ifdef HAVE_PRINTF_H
 #include <printf.h>
 #endif
+#ifdef HAVE_SIGNAL_H
+#include <signal.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 
 
 #ifdef PACKAGE
@@ -78,6 +90,13 @@ static int eocf = 0;
 static int ccount = -1;
 static int orig_ccount = -1;
 
+/* record framing of the current structure */
+static int input_framing = FRAME_LF;
+static int input_record_length = 0;
+static long long block_left = 0;        /* bytes left in the current bdw block */
+static uint8_t *sentinel = NULL;        /* byte replaced by LF after a framed text record */
+static uint8_t sentinel_byte;
+
 static uint8_t justify_string[JUSTIFY_STRING];
 
 /* write buffer definitions */
@@ -95,6 +114,7 @@ static long long int current_file_offset = 0;
 
 /* Pipe management */
 #define PIPE_OUTPUT_LEN 1048576
+#define PIPE_READ_SIZE 65536
 static uint8_t pipe_output[PIPE_OUTPUT_LEN];
 
 /* examples of non matching lines */
@@ -119,9 +139,16 @@ static uint8_t hex_to_ascii_low[]={'0','1','2','3','4','5','6','7','8','9','a','
 uint8_t *bcd_to_ascii;
 uint8_t *hex_to_ascii;
 
+/* code page translation tables of the current structure */
+uint8_t *input_decode = NULL;
+uint8_t *input_encode = NULL;
+
 
 static void print_binary_field(uint8_t,struct field *,uint8_t *);
 static void print_fixed_field(uint8_t,struct field *,uint8_t *);
+static int format_decimal(uint8_t *,long long);
+static int format_packed(uint8_t *,uint8_t *,int);
+static int decode_length_field(char,struct field *,uint8_t *,int *);
 
 inline uint8_t
 htocl(uint8_t hex)
@@ -278,7 +305,7 @@ open_input_stream(char *file,char type)
 void
 open_input_file(int stype)
 {
-    read_buffer_start = xmalloc(READ_LINE_LEN);
+    read_buffer_start = xmalloc(READ_LINE_LEN + 1);   /* room for LF after the last line */
     read_buffer = read_buffer_start;
     read_buffer_high_water = read_buffer_start + READ_LINE_LEN_HIGH;
 
@@ -392,6 +419,63 @@ find_next_LF(uint8_t *start,int length)
 
 
 
+/* cut the next record from the read buffer according the framing of the
+   structure, read_buffer is moved over descriptor words.
+   Text records are ended with LF, the original byte is restored in the next read.
+   Returns the record length
+*/
+static int
+cut_framed_record(int stype)
+{
+    int header = 0,length;
+    long long block;
+
+    if(input_framing == FRAME_BDW && block_left <= 0)
+    {
+        if(ccount < 4) panic("Truncated block descriptor word in file",current_file->name,NULL);
+        if(read_buffer[0] & 0x80)       /* extended bdw, 31 bit length */
+        {
+            block = ((long long) (read_buffer[0] & 0x7f) << 24) | ((long long) read_buffer[1] << 16) |
+                    ((long long) read_buffer[2] << 8) | (long long) read_buffer[3];
+        } else
+        {
+            block = ((long long) read_buffer[0] << 8) | (long long) read_buffer[1];
+        }
+        if(block < 8) panic("Invalid block descriptor word in file",current_file->name,NULL);
+        block_left = block - 4;
+        header = 4;
+    }
+
+    if(input_framing == FRAME_FIXED)
+    {
+        length = ccount < input_record_length ? ccount : input_record_length;
+    } else
+    {
+        if(ccount < header + 4) panic("Truncated record descriptor word in file",current_file->name,NULL);
+        length = (read_buffer[header] << 8) | read_buffer[header + 1];
+        if(length < 4 || length > ccount - header || (input_framing == FRAME_BDW && length > block_left))
+            panic("Invalid record descriptor word in file",current_file->name,NULL);
+        if(input_framing == FRAME_BDW) block_left -= length;
+        header += 4;
+        length -= 4;
+    }
+
+    read_buffer += header;
+    ccount -= header;
+    if(stype == BINARY)
+    {
+        current_offset += (long long) header;
+        current_file_offset += (long long) header;
+    } else
+    {
+        sentinel = read_buffer + length;
+        sentinel_byte = *sentinel;
+        *sentinel = '\n';
+    }
+    last_consumed = length;
+    return length;
+}
+
 /* reads one file from input */
 /* returns the line length */
 /* return -1 on EOF */
@@ -401,6 +485,12 @@ read_input_line(int stype)
     int retval;
     size_t unused;
 
+    if(sentinel != NULL)
+    {
+        *sentinel = sentinel_byte;
+        sentinel = NULL;
+    }
+
     do
     {
         if(stype == BINARY) 
@@ -434,7 +524,10 @@ read_input_line(int stype)
 
         retval = ccount;
 
-        if(ccount > 0 && stype != BINARY)
+        if(ccount > 0 && input_framing != FRAME_LF)
+        {
+            retval = cut_framed_record(stype);
+        } else if(ccount > 0 && stype != BINARY)
         {
             retval = find_next_LF(read_buffer,ccount);
             last_consumed = retval + (ccount > retval ? 1 : 0);   // add lf
@@ -473,6 +566,7 @@ read_input_line(int stype)
                 }
                 eocf = 0;
                 last_consumed = 0;
+                block_left = 0;
                 current_file_name = current_file->name;
                 current_file->lineno = 0;
                 current_file_offset = 0;
@@ -695,7 +789,7 @@ reset_guessing()
    contains the line to be examined
  */
     int
-vote_record(uint8_t quote,char *type,int header,struct record *record,int length)
+vote_record(uint8_t quote,char *type,int header,struct record *record,int length,uint8_t *buffer)
 {
     register struct id *i = record->i;
     int vote = 0,len;
@@ -711,12 +805,12 @@ vote_record(uint8_t quote,char *type,int header,struct record *record,int length
                 if(i->regexp)
                 {
                     uint8_t *field;
-                    field = get_fixed_field(i->position,length - i->position + 1,length,read_buffer);
+                    field = get_fixed_field(i->position,length - i->position + 1,length,buffer);
                     if(length >= i->position && regexec(&i->reg,field,(size_t) 0, NULL, 0) == 0) vote++;
                 } else
 #endif
                 {
-                    if(strncmp(i->key,&read_buffer[i->position -1],i->length) == 0) vote++;
+                    if(strncmp(i->key,&buffer[i->position -1],i->length) == 0) vote++;
                 }
                 break;
             case SEPARATED:
@@ -728,11 +822,11 @@ vote_record(uint8_t quote,char *type,int header,struct record *record,int length
 #ifdef HAVE_REGEX
                     if(i->regexp)
                     {
-                        if(regexec(&i->reg,get_separated_field(i->position,quote,type,read_buffer),(size_t) 0, NULL, 0) == 0) vote++;
+                        if(regexec(&i->reg,get_separated_field(i->position,quote,type,buffer),(size_t) 0, NULL, 0) == 0) vote++;
                     } else
 #endif
                     {
-                        if(strcmp(i->key,get_separated_field(i->position,quote,type,read_buffer)) == 0) vote++;
+                        if(strcmp(i->key,get_separated_field(i->position,quote,type,buffer)) == 0) vote++;
                     }
                 }
                 break;
@@ -744,13 +838,13 @@ vote_record(uint8_t quote,char *type,int header,struct record *record,int length
                     int flen = 64;
 
                     flen = length - i->position + 1 < flen ? length - i->position + 1 : flen;
-                    field = get_fixed_field(i->position,flen,length,read_buffer);
+                    field = get_fixed_field(i->position,flen,length,buffer);
 
                     if(length >= i->position && regexec(&i->reg,field,(size_t) 0, NULL, 0) == 0) vote++;
                 } else
 #endif
                 {
-                    if(memcmp(i->key,&read_buffer[i->position - 1],i->length) == 0) vote++;
+                    if(memcmp(i->key,&buffer[i->position - 1],i->length) == 0) vote++;
                 }
                 break;
         }
@@ -765,7 +859,7 @@ vote_record(uint8_t quote,char *type,int header,struct record *record,int length
                         (record->arb_length == RL_STRICT && record->length == length)) vote++;
                 break;
             case SEPARATED:
-                len = get_field_count(quote,type,read_buffer);
+                len = get_field_count(quote,type,buffer);
                 if((record->arb_length == RL_STRICT && record->length == len)  ||
                         (record->arb_length == RL_MIN && record->length <= len)) vote++;
                 break;
@@ -797,11 +891,11 @@ vote(int bindex,int line_length)
     {
         r = s->r;
         votes = 0;
-        if(s->vote == bindex && s->type[0] != BINARY)   // check only structures having all records matched so far
+        if(s->vote == bindex && s->type[0] != BINARY && s->framing == FRAME_LF)   // check only structures having all records matched so far
         {
             while(r != NULL && !votes)
             {
-                votes = vote_record(s->quote,s->type,s->header,r,line_length);
+                votes = vote_record(s->quote,s->type,s->header,r,line_length,read_buffer);
                 s->vote += votes;             /* only one vote per line */
                 r = r->next;
             }
@@ -825,13 +919,13 @@ vote_binary(int buffer_size)
     while(s != NULL)
     {
         r = s->r;
-        if(s->type[0] == BINARY)   // check only structures having all records matched so far
+        if(s->type[0] == BINARY && s->framing == FRAME_LF)   // check only structures having all records matched so far
         {
             while(r != NULL && !s->vote)
             {
                 if(r->i != NULL)
                 {
-                    if(vote_record(s->quote,s->type,s->header,r,buffer_size)) s->vote = 1;
+                    if(vote_record(s->quote,s->type,s->header,r,buffer_size,read_buffer)) s->vote = 1;
                 }
                 r = r->next;
             }
@@ -963,6 +1057,21 @@ writec(uint8_t c)
     write_pos++;
 }
 
+/* make room for length bytes after write_pos */
+static void
+reserve_write(int length)
+{
+    int written = write_pos - write_buffer;
+
+    while(written + length >= write_buffer_size - 1)
+    {
+        write_buffer_size = write_buffer_size * 2;
+        write_buffer = xrealloc(write_buffer,write_buffer_size);
+        write_pos = write_buffer + written;
+        write_buffer_end = write_buffer + (write_buffer_size - 1);
+    }
+}
+
 
 /* write string to write buffer */
 inline void
@@ -996,11 +1105,24 @@ flush_write()
 void
 print_raw(int size, uint8_t *buffer,int stype)
 {
+    uint8_t rdw[4];
+
+    if(input_framing == FRAME_RDW || input_framing == FRAME_BDW)   /* records are written unblocked with a new rdw */
+    {
+        rdw[0] = (uint8_t) ((size + 4) >> 8);
+        rdw[1] = (uint8_t) (size + 4);
+        rdw[2] = 0;
+        rdw[3] = 0;
+        if(fwrite(rdw,1,4,default_output_fp) != 4)
+        {
+            panic("Error writing to",default_output_file,NULL);
+        }
+    }
     if(fwrite(buffer,1,size,default_output_fp) != size)
     {
         panic("Error writing to",default_output_file,NULL);
     }
-    if(stype != BINARY) fputc('\n',default_output_fp);
+    if(stype != BINARY && input_framing == FRAME_LF) fputc('\n',default_output_fp);
 }
     
 
@@ -1172,7 +1294,13 @@ size_t update_field_positions(char *type,uint8_t quote,struct record *r,int len,
 
     retval = last_consumed;
 
-    if(r->length_field)    // If dynamic length
+    if(r->length_field && decode_length_field(type[0],r->length_field,buffer,&var_record_length))
+    {
+         var_record_length += r->var_length_adjust;
+         if(var_record_length >= len) var_record_length = len - 1;
+         var_field_length = var_record_length - r->length;
+         if(var_field_length < 0) var_field_length = 0;
+    } else if(r->length_field)    // If dynamic length
     {
         start_write();
         field_start = write_pos;
@@ -1196,22 +1324,17 @@ size_t update_field_positions(char *type,uint8_t quote,struct record *r,int len,
     switch(type[0])
     {
         case FIXED_LENGTH:
-            if(r->arb_length == RL_MIN)
+            if(r->arb_length == RL_MIN && r->last_field != NULL)
             {
-                while(f != NULL)
+                f = r->last_field;    // check last field existense
+                if(len > f->position)
                 {
-                    if(f->next == NULL) // check last field existense
-                    {
-                        if(len > f->position)
-                        {
-                            f->bposition = f->position;
-                        } else
-                        {
-                            f->bposition = -1;
-                        }
-                    }
-                    f = f->next;
+                    f->bposition = f->position;
+                } else
+                {
+                    f->bposition = -1;
                 }
+                f = f->next;
             }
         case BINARY:		   // no break here
             if(type[0] == BINARY) 
@@ -1307,15 +1430,229 @@ select_record(struct structure *s,int length,uint8_t *buffer)
 
     while(r != NULL)
     {
-        if(vote_record(s->quote,s->type,s->header,r,length)) return r;
+        if(vote_record(s->quote,s->type,s->header,r,length,buffer)) return r;
         r = r->next;
     }
 
     return NULL;
 }
 
+#if defined(HAVE_WORKING_FORK) && defined(HAVE_DUP2) && defined(HAVE_PIPE) && defined(HAVE_POLL_H)
+/* start a persistent filter command, the command stays running until the input is processed */
+static void
+start_persistent_pipe(struct pipe *p)
+{
+    int in_fds[2];
+    int out_fds[2];
+    pid_t pid;
+
+    if (pipe(in_fds) != 0 || pipe(out_fds) != 0) panic("Cannot create pipe",strerror(errno),NULL);
+    fflush(NULL);  /* buffered output must not be duplicated to child */
+    pid = fork();
+    if(pid == (pid_t) 0) /* Child */
+    {
+        close(in_fds[1]);
+        close(out_fds[0]);
+        if(dup2(in_fds[0],STDIN_FILENO) == -1) panic("dup2 error",strerror(errno),NULL);
+        close(in_fds[0]);
+        if(dup2(out_fds[1],STDOUT_FILENO) == -1) panic("dup2 error",strerror(errno),NULL);
+        close(out_fds[1]);
+        if(execl(SHELL_CMD, "sh", "-c", p->command, NULL) == -1) panic("Starting a shell with execl failed",p->command,strerror(errno));
+        _exit(EXIT_SUCCESS);
+    } else if(pid > (pid_t) 0)
+    {
+        close(in_fds[0]);
+        close(out_fds[1]);
+        /* commands started later must not keep these pipes open */
+        if(fcntl(in_fds[1],F_SETFD,FD_CLOEXEC) == -1 || fcntl(out_fds[0],F_SETFD,FD_CLOEXEC) == -1 ||
+           fcntl(in_fds[1],F_SETFL,fcntl(in_fds[1],F_GETFL) | O_NONBLOCK) == -1)
+            panic("Cannot set pipe flags",p->command,strerror(errno));
+        p->wfd = in_fds[1];
+        p->rfd = out_fds[0];
+        p->pid = pid;
+    } else
+    {
+        panic("Cannot fork",strerror(errno),NULL);
+    }
+}
+
+/* add one value to the values waiting to be written to a persistent filter.
+   In line mode value is terminated by linefeed,
+   in length mode it is preceded by a line containing the byte count
+ */
+static void
+persistent_request(struct pipe *p,uint8_t *value,size_t len)
+{
+    char len_line[32];
+    size_t hlen = 0;
+
+    if(p->mode == PIPE_LENGTH) hlen = (size_t) sprintf(len_line,"%lu\n",(unsigned long) len);
+
+    if(p->wlen + hlen + len + 1 > p->wsize)
+    {
+        p->wsize = 2 * (p->wlen + hlen + len + 1);
+        p->wbuf = xrealloc(p->wbuf,p->wsize);
+    }
+    memcpy(&p->wbuf[p->wlen],len_line,hlen);
+    p->wlen += hlen;
+    memcpy(&p->wbuf[p->wlen],value,len);
+    p->wlen += len;
+    if(p->mode == PIPE_LINES) p->wbuf[p->wlen++] = '\n';
+}
+
+/* finds the reply starting at pos in the read buffer.
+   Returns the reply length, or -1 if the reply is not read completely.
+   The reply starts at *start and the next reply at *next
+ */
+static long
+persistent_reply(struct pipe *p,size_t pos,size_t *start,size_t *next)
+{
+    uint8_t *nl;
+    char len_line[32];
+    size_t hlen;
+    long len;
+
+    if(pos >= p->rlen) return -1;
+    nl = memchr(&p->rbuf[pos],'\n',p->rlen - pos);
+    if(nl == NULL) return -1;
+    hlen = (size_t) (nl - &p->rbuf[pos]);
+
+    if(p->mode == PIPE_LINES)
+    {
+        *start = pos;
+        *next = pos + hlen + 1;
+        return (long) hlen;
+    }
+
+    if(hlen >= sizeof(len_line)) hlen = sizeof(len_line) - 1;
+    memcpy(len_line,&p->rbuf[pos],hlen);
+    len_line[hlen] = 0;
+    len = atol(len_line);
+    if(len < 0) len = 0;
+
+    *start = (size_t) (nl - p->rbuf) + 1;
+    if(*start + (size_t) len > p->rlen) return -1;
+    *next = *start + (size_t) len;
+    return len;
+}
+
+/* writes all waiting values and reads until count replies are in the read buffer.
+   Writing and reading are done in turns when the pipes are ready, so the command
+   cannot block on writing replies while ffe is writing values
+ */
+static void
+persistent_exchange(struct pipe *p,int count)
+{
+    struct pollfd pfd[2];
+    size_t written = 0,scan,start;
+    ssize_t got;
+    int complete = 0,nfds,ready;
+
+    if(p->rpos)
+    {
+        memmove(p->rbuf,&p->rbuf[p->rpos],p->rlen - p->rpos);
+        p->rlen -= p->rpos;
+        p->rpos = 0;
+    }
+    scan = 0;
+    while(complete < count && persistent_reply(p,scan,&start,&scan) >= 0) complete++;
+
+    while(complete < count || written < p->wlen)
+    {
+        pfd[0].fd = p->rfd;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        nfds = 1;
+        if(written < p->wlen)
+        {
+            pfd[1].fd = p->wfd;
+            pfd[1].events = POLLOUT;
+            pfd[1].revents = 0;
+            nfds = 2;
+        }
+
+        ready = poll(pfd,nfds,p->timeout ? p->timeout * 1000 : -1);
+        if(ready == -1)
+        {
+            if(errno == EINTR) continue;
+            panic("Cannot poll filter command",p->command,strerror(errno));
+        }
+        if(ready == 0) panic("Filter command does not reply in time, it must flush its output after every reply",p->command,NULL);
+
+        if(nfds == 2 && pfd[1].revents)
+        {
+            got = write(p->wfd,&p->wbuf[written],p->wlen - written);
+            if(got == -1 && errno != EAGAIN && errno != EINTR) panic("Cannot write to command",p->command,strerror(errno));
+            if(got > 0) written += (size_t) got;
+        }
+
+        if(pfd[0].revents)
+        {
+            if(p->rlen + PIPE_READ_SIZE > p->rsize)
+            {
+                p->rsize = 2 * p->rlen + PIPE_READ_SIZE;
+                p->rbuf = xrealloc(p->rbuf,p->rsize);
+            }
+            got = read(p->rfd,&p->rbuf[p->rlen],p->rsize - p->rlen);
+            if(got == 0) panic("Filter command ended unexpectedly",p->command,NULL);
+            if(got == -1)
+            {
+                if(errno == EINTR || errno == EAGAIN) continue;
+                panic("Cannot read from command",p->command,strerror(errno));
+            }
+            p->rlen += (size_t) got;
+            while(complete < count && persistent_reply(p,scan,&start,&scan) >= 0) complete++;
+        }
+    }
+    p->wlen = 0;
+}
+
+/* exchange one value with a persistent filter */
+static int
+execute_persistent_pipe(uint8_t *input,int input_length,struct pipe *p)
+{
+    size_t start,next;
+    long len;
+
+    if(p->wfd == -1) start_persistent_pipe(p);
+
+    if(p->mode == PIPE_LINES && memchr(input,'\n',input_length) != NULL) panic("Value containing a linefeed cannot be written to a line mode filter",p->command,NULL);
+
+    persistent_request(p,input,(size_t) input_length);
+    persistent_exchange(p,1);
+
+    len = persistent_reply(p,p->rpos,&start,&next);
+    if(len > PIPE_OUTPUT_LEN - 1) len = PIPE_OUTPUT_LEN - 1;
+    memcpy(pipe_output,&p->rbuf[start],(size_t) len);
+    pipe_output[len] = 0;
+    p->rpos = next;
+    return (int) len;
+}
+
+/* stop persistent filter commands */
+static void
+close_persistent_pipes()
+{
+    struct pipe *p = pipes;
+
+    while(p != NULL)
+    {
+        if(p->wfd != -1)
+        {
+            close(p->wfd);
+            close(p->rfd);
+            while(waitpid(p->pid,NULL,0) == -1 && errno == EINTR);
+            p->wfd = -1;
+            p->rfd = -1;
+        }
+        p = p->next;
+    }
+}
+#endif
+
 /* write field content to pipe and read the output, returns bytes read. Output is written to pipe_output  */
-int execute_pipe(uint8_t *input,int input_length,struct pipe *p)
+static int
+run_pipe(uint8_t *input,int input_length,struct pipe *p)
 {
      int in_fds[2];
      int out_fds[2];
@@ -1323,9 +1660,40 @@ int execute_pipe(uint8_t *input,int input_length,struct pipe *p)
      FILE *rfd,*wfd;
      int ret=0;
 
+     if(p->mode == PIPE_BUILTIN)
+     {
+         uint8_t *output;
+
+         ret = execute_transform(input,input_length,p->t,&output);
+         if(ret > PIPE_OUTPUT_LEN - 1) ret = PIPE_OUTPUT_LEN - 1;
+         memcpy(pipe_output,output,ret);
+         pipe_output[ret] = 0;
+         return ret;
+     }
+
      if(!input_length) return 0; // dont pipe with no data
 
+     if(p->batch_results != NULL)
+     {
+         uint8_t *output = hash_table_find(p->batch_results,input,input_length);
+
+         if(output != NULL)  /* otherwise the value was not read ahead, command is started for this value only */
+         {
+             ret = strlen((char *) output);
+             if(ret > PIPE_OUTPUT_LEN - 1) ret = PIPE_OUTPUT_LEN - 1;
+             memcpy(pipe_output,output,ret);
+             pipe_output[ret] = 0;
+             return ret;
+         }
+     }
+
 #if defined(HAVE_WORKING_FORK) && defined(HAVE_DUP2) && defined(HAVE_PIPE)
+#ifdef HAVE_POLL_H
+       if(p->mode == PIPE_LINES || p->mode == PIPE_LENGTH) return execute_persistent_pipe(input,input_length,p);
+#else
+       if(p->mode == PIPE_LINES || p->mode == PIPE_LENGTH) panic("Persistent filters are not supported in this system",p->command,NULL);
+#endif
+
        if (pipe(in_fds) != 0 || pipe(out_fds) != 0) panic("Cannot create pipe",strerror(errno),NULL);
        pid = fork();
        if(pid == (pid_t) 0) /* Child */
@@ -1362,8 +1730,73 @@ panic("pipe is not supported in this system",NULL,NULL);
 return ret;
 }
 
+/* run filter, outputs of cached filters are searched from the cache first */
+int
+execute_pipe(uint8_t *input,int input_length,struct pipe *p)
+{
+    uint8_t *cached;
+    size_t cached_len;
+    int ret;
+
+    if(p->cache == NULL) return run_pipe(input,input_length,p);
+
+    cached = value_cache_find(p->cache,input,input_length,&cached_len);
+    if(cached != NULL)
+    {
+        memcpy(pipe_output,cached,cached_len + 1);
+        return (int) cached_len;
+    }
+
+    ret = run_pipe(input,input_length,p);
+    value_cache_store(p->cache,input,input_length,pipe_output,ret);
+    return ret;
+}
+
+/* print hit rates of filter caches */
+static void
+print_pipe_cache_stats()
+{
+    struct pipe *p = pipes;
+    struct value_cache *c;
+
+    while(p != NULL)
+    {
+        c = p->cache;
+        if(c != NULL && c->hits + c->misses)
+        {
+            fprintf(stderr,"%s: Filter '%s' cache: %lu hits, %lu misses, hit rate %.1f%%\n",program,p->name,
+                    c->hits,c->misses,100.0 * c->hits / (c->hits + c->misses));
+        }
+        p = p->next;
+    }
+}
+
 
 /* print a single fixed field */
+/* translate field from the input code page, the result is null terminated.
+   Field having no length ends to the end of line */
+static uint8_t *
+decode_field(uint8_t *data,int length)
+{
+    static uint8_t *decoded = NULL;
+    static int decoded_size = 0;
+    register int i = 0;
+
+    if(!length) while(data[length] != '\n' && data[length]) length++;
+    if(length >= decoded_size)
+    {
+        decoded_size = length + 1024;
+        decoded = xrealloc(decoded,decoded_size);
+    }
+    while(i < length)
+    {
+        decoded[i] = input_decode[data[i]];
+        i++;
+    }
+    decoded[length] = 0;
+    return decoded;
+}
+
 void
 print_fixed_field(uint8_t format,struct field *f,uint8_t *buffer)
 {
@@ -1382,6 +1815,7 @@ print_fixed_field(uint8_t format,struct field *f,uint8_t *buffer)
     {
         if(f->bposition < 0) return;  /* last variable length field is missing */
         data = &buffer[f->bposition];
+        if(input_decode != NULL) data = decode_field(data,f->length);
 
         if(f->p != NULL)
         {
@@ -1454,6 +1888,124 @@ print_fixed_field(uint8_t format,struct field *f,uint8_t *buffer)
     }
 }
 
+/* decoder for a binary field, integers are decoded without converting them to text */
+static int
+bind_decoder(struct field *f)
+{
+    int decoder;
+
+    if(f->const_data != NULL || (f->type != F_INT && f->type != F_UINT)) return DEC_NONE;
+
+    switch(f->length)
+    {
+        case 1:
+            decoder = DEC_INT8;
+            break;
+        case 2:
+            decoder = DEC_INT16;
+            break;
+        case 4:
+            decoder = DEC_INT32;
+            break;
+        case 8:
+            decoder = DEC_INT64;
+            break;
+        default:
+            return DEC_NONE;
+    }
+
+    if(f->type == F_UINT) decoder++;
+
+    if(f->length > 1 && f->endianess != system_endianess)
+    {
+        if((f->endianess != F_BIG_ENDIAN && f->endianess != F_LITTLE_ENDIAN) ||
+           (system_endianess != F_BIG_ENDIAN && system_endianess != F_LITTLE_ENDIAN)) return DEC_NONE;
+        decoder |= DEC_SWAP;
+    }
+    return decoder;
+}
+
+/* decode binary integer, data can be unaligned */
+static inline int64_t
+decode_integer(int decoder,uint8_t *p)
+{
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch(decoder)
+    {
+        case DEC_INT8:
+            return (int8_t) *p;
+        case DEC_UINT8:
+            return *p;
+        case DEC_INT16:
+            memcpy(&u16,p,2);
+            return (int16_t) u16;
+        case DEC_INT16 | DEC_SWAP:
+            memcpy(&u16,p,2);
+            return (int16_t) BSWAP16(u16);
+        case DEC_UINT16:
+            memcpy(&u16,p,2);
+            return u16;
+        case DEC_UINT16 | DEC_SWAP:
+            memcpy(&u16,p,2);
+            return (uint16_t) BSWAP16(u16);
+        case DEC_INT32:
+            memcpy(&u32,p,4);
+            return (int32_t) u32;
+        case DEC_INT32 | DEC_SWAP:
+            memcpy(&u32,p,4);
+            return (int32_t) BSWAP32(u32);
+        case DEC_UINT32:
+            memcpy(&u32,p,4);
+            return u32;
+        case DEC_UINT32 | DEC_SWAP:
+            memcpy(&u32,p,4);
+            return (uint32_t) BSWAP32(u32);
+        case DEC_INT64:
+        case DEC_UINT64:
+            memcpy(&u64,p,8);
+            return (int64_t) u64;
+        case DEC_INT64 | DEC_SWAP:
+        case DEC_UINT64 | DEC_SWAP:
+            memcpy(&u64,p,8);
+            return (int64_t) BSWAP64(u64);
+    }
+    return 0;
+}
+
+/* value of a record length field. Integers and text numbers are decoded
+   directly, returns 0 if the field must be printed and scanned */
+static int
+decode_length_field(char type,struct field *f,uint8_t *buffer,int *value)
+{
+    register uint8_t *p,*end;
+    int negative = 0;
+    long v = 0;
+
+    if(f->const_data != NULL || f->p != NULL || f->bposition < 0) return 0;
+
+    p = &buffer[f->bposition];
+
+    if(type == BINARY && f->decoder != DEC_NONE)
+    {
+        *value = (int) decode_integer(f->decoder,p);
+        return 1;
+    }
+
+    if(f->type != F_ASC || !f->length || input_decode != NULL) return 0;
+
+    end = p + f->length;
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if(p == end || !isdigit(*p)) return 0;
+    while(p < end && isdigit(*p)) v = v * 10 + (*p++ - '0');
+
+    *value = (int) (negative ? -v : v);
+    return 1;
+}
+
 /* print a single binary field 
    if field type is ASC, fixed field printing is used 
 */
@@ -1461,7 +2013,7 @@ void
 print_binary_field(uint8_t format,struct field *f,uint8_t *buffer)
 {
     register uint8_t *p,*data_end;
-    uint8_t *data,c;
+    uint8_t *data;
     char *pf;
     static uint8_t pb[2 * FIELD_SIZE];
     
@@ -1483,6 +2035,21 @@ print_binary_field(uint8_t format,struct field *f,uint8_t *buffer)
     }
 
 
+    if(f->decoder != DEC_NONE && (format == 'd' || format == 't' || format == 'D' || format == 'C'))
+    {
+        long long v = decode_integer(f->decoder,&buffer[f->bposition]);
+
+        if(v < 0 && f->type == F_UINT)   /* above LLONG_MAX */
+        {
+            sprintf(pb,"%llu",(unsigned long long) v);
+        } else
+        {
+            pb[format_decimal(pb,v)] = 0;
+        }
+        writes(pb);
+        return;
+    }
+
     switch(f->type)
     {
         case F_INT:
@@ -1519,7 +2086,7 @@ print_binary_field(uint8_t format,struct field *f,uint8_t *buffer)
             switch(f->type)
             {
                 case F_CHAR:
-                    writec(*data);
+                    writec(input_decode != NULL ? input_decode[*data] : *data);
                     break;
                 case F_INT:
                     switch(f->length)
@@ -1573,62 +2140,17 @@ print_binary_field(uint8_t format,struct field *f,uint8_t *buffer)
                     sprintf(pb,"%f",(double) *(double *) data);
                     writes(pb);
                     break;
-                case F_BCD:
-                    p = data;
-                    data_end = p + f->length;
-                    switch(f->endianess)
-                    {
-                        case F_BIG_ENDIAN:
-                            do
-                            {
-                                c = bcdtocb(*p);
-                                if(c)
-                                {
-                                    writec(c);
-                                    c = bcdtocl(*p);
-                                    if(c) writec(c);
-                                }
-                                p++;
-                            } while(p < data_end && c);
-                            break;
-                        case F_LITTLE_ENDIAN:
-                            do
-                            {
-                                c = bcdtocl(*p);
-                                if(c)
-                                {
-                                    writec(c);
-                                    c = bcdtocb(*p);
-                                    if(c) writec(c);
-                                }
-                                p++;
-                            } while(p < data_end && c);
-                            break;
-                    }
+                case F_COMP3:
+                    reserve_write(2 * f->length + 1);
+                    write_pos += format_packed(write_pos,data,f->length);
+                    break;
+                case F_BCD:         /* both digits of a byte are expanded at once */
+                    reserve_write(2 * f->length);
+                    write_pos += bcd_expand(write_pos,data,f->length,f->endianess,hex_to_ascii == hex_to_ascii_cap);
                     break;
                 case F_HEX:
-                    p = data;
-                    data_end = p + f->length;
-                    switch(f->endianess)
-                    {
-                        case F_BIG_ENDIAN:
-                            while(p < data_end)
-                            {
-                                writec(htocb(*p));
-                                writec(htocl(*p));
-                                p++;
-                            }
-                            break;
-                        case F_LITTLE_ENDIAN:
-                            p += f->length - 1;
-                            while(p >= data)
-                            {
-                                writec(htocb(*p));
-                                writec(htocl(*p));
-                                p--;
-                            }
-                            break;
-                    }
+                    reserve_write(2 * f->length);
+                    write_pos += hex_expand(write_pos,data,f->length,f->endianess,hex_to_ascii == hex_to_ascii_cap);
                     break;
             }
     }
@@ -1636,20 +2158,52 @@ print_binary_field(uint8_t format,struct field *f,uint8_t *buffer)
 
 
 
-/* print a single separated field */
-void
-print_separated_field(uint8_t format,uint8_t quote,uint8_t separator,struct field *f,uint8_t *buffer)
+/* returns the end of raw separated field contents starting from p, contents are written to filters as such */
+static uint8_t *
+separated_pipe_input_end(uint8_t *p,uint8_t quote,uint8_t separator)
 {
-    register uint8_t *p;
-    uint8_t *start;
     int inside_quote = 0;
 
-    start = write_pos;
-
-    if(f->const_data != NULL)   // use fixed field printing for const data
-    {
-        print_fixed_field(format,f,buffer);
-    } else
+    if(*p == quote && quote) {
+        p++;
+        inside_quote = 1;
+    }
+#ifdef WIN32
+    while((*p != separator || inside_quote) && *p != '\n' && *p != '\r')
+#else
+    while((*p != separator || inside_quote) && *p != '\n')
+#endif
+    {
+        if(((*p == quote && p[1] == quote) || (*p == '\\' && p[1] == quote)) && quote) 
+        {
+            p++;
+        } else if(*p == quote)
+        {
+            if(inside_quote) inside_quote=0;
+        }
+#ifdef WIN32
+        if(*p != '\n' && *p != '\r') p++;
+#else
+        if(*p != '\n') p++;
+#endif
+    }
+    return p;
+}
+
+/* print a single separated field */
+void
+print_separated_field(uint8_t format,uint8_t quote,uint8_t separator,struct field *f,uint8_t *buffer)
+{
+    register uint8_t *p;
+    uint8_t *start;
+    int inside_quote = 0;
+
+    start = write_pos;
+
+    if(f->const_data != NULL)   // use fixed field printing for const data
+    {
+        print_fixed_field(format,f,buffer);
+    } else
     {
         if(f->bposition < 0)
         {
@@ -1659,30 +2213,7 @@ print_separated_field(uint8_t format,uint8_t quote,uint8_t separator,struct fiel
 
         if(f->p != NULL)
         {
-            p = &buffer[f->bposition];
-            if(*p == quote && quote) {
-                p++;
-                inside_quote = 1;
-            }
-#ifdef WIN32
-            while((*p != separator || inside_quote) && *p != '\n' && *p != '\r')
-#else
-            while((*p != separator || inside_quote) && *p != '\n')
-#endif
-            {
-                if(((*p == quote && p[1] == quote) || (*p == '\\' && p[1] == quote)) && quote) 
-                {
-                    p++;
-                } else if(*p == quote)
-                {
-                    if(inside_quote) inside_quote=0;
-                }
-#ifdef WIN32
-                if(*p != '\n' && *p != '\r') p++;
-#else
-                if(*p != '\n') p++;
-#endif
-            }            
+            p = separated_pipe_input_end(&buffer[f->bposition],quote,separator);
             int i=0,len;
 	        len = execute_pipe(&buffer[f->bposition],p - &buffer[f->bposition],f->p);
             while(i < len && pipe_output[i]) writec(pipe_output[i++]);
@@ -1757,55 +2288,57 @@ print_separated_field(uint8_t format,uint8_t quote,uint8_t separator,struct fiel
     }
 }
 
-/* search the lookup table, return the found value */
+/* write trimmed field value for lookup key */
+static void
+print_key_field(struct structure *s,struct field *f,uint8_t *buffer)
+{
+    switch(s->type[0])
+    {
+        case FIXED_LENGTH:
+            print_fixed_field('t',f,buffer);
+            break;
+        case SEPARATED:
+            print_separated_field('t',s->quote,s->type[1],f,buffer);
+            break;
+        case BINARY:
+            print_binary_field('t',f,buffer);
+            break;
+    }
+}
+
+/* search the lookup table, return the found value.
+   pairs and files read in memory are searched before the index */
 uint8_t *
 make_lookup(struct lookup *l,uint8_t *search)
 {
-    register uint8_t *k,*s;
-    int search_len = strlen(search);
-    uint8_t *ret_val = NULL;
-    struct lookup_data *d;
+    size_t search_len = strlen(search);
+    size_t match_len;
+    uint8_t *ret_val = NULL,*index_val;
 
     switch(l->type)
     {
         case EXACT:
-
-            d = l->data[hash(search,0)];
-
-	    while(d != NULL && ret_val == NULL)
-	    {
-                k = d->key;
-		s = search;
-		while(*k == *s && *k) 
-		{
-		   k++;
-		   s++;
-		}
-		if(!*s && !*k) ret_val = d->value;
-		d = d->next;
-	    }
-	    break;
-	case LONGEST:
-            while(search_len && ret_val == NULL)
-	    {
-                d = l->data[hash(search,0)];
-
-	        while(d != NULL && ret_val == NULL)
-	        {
-		    k = d->key;
-		    s = search;
-		    while(*k == *s && *k) 
-		    {
-			    k++;
-			    s++;
-		    }
-		    if(!*s && !*k) ret_val = d->value;
-		    d = d->next;
-	         }
-                 search_len--;
-                 search[search_len] = 0;
-	    }
-	    break;
+            ret_val = hash_table_find(l->data,search,search_len);
+            if(ret_val == NULL && l->index != NULL) ret_val = hash_table_find(l->index,search,search_len);
+            break;
+        case LONGEST:
+            ret_val = radix_lookup(l->radix,search,search_len,&match_len);
+            if(l->index != NULL)
+            {
+                while(search_len > match_len)
+                {
+                    if((index_val = hash_table_find(l->index,search,search_len)) != NULL)
+                    {
+                        ret_val = index_val;
+                        break;
+                    }
+                    search_len--;
+                }
+            }
+            break;
+        case RANGE:
+            ret_val = range_lookup(l->ranges,search);
+            break;
     }
 
     if(ret_val == NULL) ret_val = l->default_value;
@@ -1824,6 +2357,230 @@ print_indent(uint8_t *buffer,int times)
 /* format field with printf
  */
 #define CONV_BUF_SIZE 1048576
+
+#ifdef HAVE_PRINTF_H
+/* pad formatted value in body to field width, sign_len leading bytes are kept before zero padding */
+static void
+pad_conversion(struct format *f,uint8_t *out,uint8_t *body,int len,int sign_len)
+{
+    int pad = f->width > len ? f->width - len : 0;
+
+    if(f->left)
+    {
+        memcpy(out,body,len);
+        memset(out + len,' ',pad);
+    } else if(f->zero)
+    {
+        memcpy(out,body,sign_len);
+        memset(out + sign_len,'0',pad);
+        memcpy(out + sign_len + pad,body + sign_len,len - sign_len);
+    } else
+    {
+        memset(out,' ',pad);
+        memcpy(out + pad,body,len);
+    }
+    out[len + pad] = 0;
+}
+
+static int
+format_decimal(uint8_t *body,long long v)
+{
+    unsigned long long u = v < 0 ? -(unsigned long long) v : (unsigned long long) v;
+    uint8_t digits[24];
+    int n = 0,len = 0;
+
+    do
+    {
+        digits[n++] = '0' + (uint8_t) (u % 10);
+        u /= 10;
+    } while(u);
+
+    if(v < 0) body[len++] = '-';
+    while(n) body[len++] = digits[--n];
+    return len;
+}
+
+/* packed decimal (COBOL COMP-3), the last nybble is the sign: B and D are negative,
+   others positive. Leading zeros are not printed */
+static int
+format_packed(uint8_t *body,uint8_t *data,int length)
+{
+    uint8_t sign = data[length - 1] & 0x0f;
+    int digits = 2 * length - 1;
+    int i,len = 0,nonzero = 0;
+    uint8_t d;
+
+    if(sign == 0x0b || sign == 0x0d) body[len++] = '-';
+    for(i = 0;i < digits;i++)
+    {
+        d = i & 1 ? data[i >> 1] & 0x0f : data[i >> 1] >> 4;
+        if(d) nonzero = 1;
+        if(nonzero || i == digits - 1) body[len++] = hex_to_ascii[d];
+    }
+    if(!nonzero)    /* no negative zero */
+    {
+        body[0] = '0';
+        len = 1;
+    }
+    return len;
+}
+
+static int
+format_hex(uint8_t *body,unsigned int u,int upper)
+{
+    char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    uint8_t digits[16];
+    int n = 0,len = 0;
+
+    do
+    {
+        digits[n++] = hex[u & 0xf];
+        u >>= 4;
+    } while(u);
+
+    while(n) body[len++] = digits[--n];
+    return len;
+}
+
+/* %.Nf directly from the decimal text. The text is rounded as such, which gives the same
+   result as rounding the binary value when there are at most 15 significant digits
+   and the text is not exactly halfway. Returns -1 if snprintf must be used.
+ */
+static int
+format_float(struct format *f,uint8_t *s,uint8_t *body)
+{
+    uint8_t digits[40];
+    uint8_t *int_start,*frac_start = NULL;
+    int int_len,frac_len = 0,int_digits,digit_count = 0;
+    int neg = 0,seen = 0,n = f->precision,i,len = 0,round_up = 0;
+
+    while(isspace(*s)) s++;
+    if(*s == '-' || *s == '+')
+    {
+        neg = *s == '-';
+        s++;
+    }
+    while(*s == '0')
+    {
+        seen = 1;
+        s++;
+    }
+    int_start = s;
+    while(isdigit(*s)) s++;
+    int_len = (int) (s - int_start);
+    if(*s == '.')
+    {
+        frac_start = ++s;
+        while(isdigit(*s)) s++;
+        frac_len = (int) (s - frac_start);
+    }
+
+    /* exponents, hexadecimal numbers, infinity and nan */
+    if(strchr("eExXiInN",*s) != NULL && *s) return -1;
+    if(int_len + (n > frac_len ? n : frac_len) > 15) return -1;
+
+    if(int_len || frac_len) seen = 1;
+    if(!seen) neg = 0;     /* not a number, value is zero */
+
+    if(int_len)
+    {
+        memcpy(digits,int_start,int_len);
+        digit_count = int_len;
+    } else
+    {
+        digits[digit_count++] = '0';
+    }
+    int_digits = digit_count;
+    for(i = 0;i < n;i++) digits[digit_count++] = i < frac_len ? frac_start[i] : '0';
+
+    if(frac_len > n)
+    {
+        if(frac_start[n] > '5') round_up = 1;
+        if(frac_start[n] == '5')
+        {
+            for(i = n + 1;i < frac_len && frac_start[i] == '0';i++);
+            if(i == frac_len) return -1;    /* halfway, binary value decides */
+            round_up = 1;
+        }
+    }
+
+    if(round_up)
+    {
+        i = digit_count - 1;
+        while(i >= 0 && digits[i] == '9') digits[i--] = '0';
+        if(i >= 0)
+        {
+            digits[i]++;
+        } else
+        {
+            memmove(digits + 1,digits,digit_count++);
+            digits[0] = '1';
+            int_digits++;
+        }
+    }
+
+    if(neg) body[len++] = '-';
+    memcpy(body + len,digits,int_digits);
+    len += int_digits;
+    if(n)
+    {
+        body[len++] = '.';
+        memcpy(body + len,digits + int_digits,n);
+        len += n;
+    }
+    return len;
+}
+
+/* conversions analysed in parse_conversion, returns 0 if snprintf must be used */
+static int
+fast_conversion(struct format *f,uint8_t *start,uint8_t *out)
+{
+    uint8_t body[64];
+    long long v;
+    size_t slen;
+    int len;
+
+    switch(f->fast)
+    {
+        case FMT_INT:
+            switch(f->type)
+            {
+                case PA_INT:
+                    v = atoi(start);
+                    break;
+                case PA_INT|PA_FLAG_LONG:
+                    v = atol(start);
+                    break;
+                case PA_INT|PA_FLAG_LONG_LONG:
+                    v = atoll(start);
+                    break;
+                default:
+                    return 0;
+            }
+            len = format_decimal(body,v);
+            pad_conversion(f,out,body,len,v < 0);
+            return 1;
+        case FMT_HEX:
+            if(f->type != PA_INT) return 0;
+            len = format_hex(body,(unsigned int) atoi(start),f->conv == 'X');
+            pad_conversion(f,out,body,len,0);
+            return 1;
+        case FMT_FLOAT:
+            len = format_float(f,start,body);
+            if(len < 0) return 0;
+            pad_conversion(f,out,body,len,body[0] == '-');
+            return 1;
+        case FMT_STRING:
+            slen = strlen((char *) start);
+            if(f->precision >= 0 && slen > (size_t) f->precision) slen = f->precision;
+            if(slen + f->width >= CONV_BUF_SIZE) return 0;
+            pad_conversion(f,out,start,(int) slen,0);
+            return 1;
+    }
+    return 0;
+}
+#endif
+
 void
 make_conversion(struct format *f,uint8_t *start)
 {
@@ -1834,6 +2591,13 @@ make_conversion(struct format *f,uint8_t *start)
     conv_buffer[0] = 0;
 
 #ifdef HAVE_PRINTF_H
+    if(f->fast != FMT_GENERIC && fast_conversion(f,start,conv_buffer))
+    {
+        write_pos = start;
+        writes(conv_buffer);
+        return;
+    }
+
     switch(f->type)
     {
         case PA_INT:
@@ -1888,26 +2652,21 @@ print_fields(struct structure *s, struct record *r,uint8_t *buffer)
     int retval = 0;
     int replacing,just_replaced;
     int lookup_len;
-    struct print_field *pf = r->pf;
+    struct print_field *pf;
+    struct print_field *pf_end = r->pf + r->pf_count;
     struct output *o;
 
-    while(pf != NULL) {
-        pf->justify_length = -1;
-        pf = pf->next;
-    }
-
-    pf = r->pf;
-
     start_write();
     
-    while(pf != NULL)
+    for(pf = r->pf;pf < pf_end;pf++)
     {
-        o = pf->f->o ? pf->f->o : r->o;
+        o = pf->o;
+        pf->justify_length = -1;
 
         if(o != no_output)
         {
             justify = o->justify;
-            d = o->data;
+            d = pf->directives;
             data_start = write_pos;
             pf->data = data_start;
             pf->empty = 1;
@@ -1915,8 +2674,6 @@ print_fields(struct structure *s, struct record *r,uint8_t *buffer)
             just_replaced = 0;
             lookup_value = NULL;
 
-            if(pf->f->lookup != NULL) d = o->lookup;
-
             if(o->hex_cap)
             {
                 bcd_to_ascii = bcd_to_ascii_cap;
@@ -1991,20 +2748,31 @@ print_fields(struct structure *s, struct record *r,uint8_t *buffer)
                                 if(lookup_value == NULL)
                                 {
                                     field_start = write_pos;  // misuse write buffer for temp space for field value
-                                    switch(s->type[0])        // write trimmed data for search key
+                                    if(pf->f->key != NULL)     // composite key, fields separated by key separator
+                                    {
+                                        for(i = 0;i < pf->f->key_count;i++)
+                                        {
+                                            if(i) writec(pf->f->lookup->key_separator);
+                                            print_key_field(s,pf->f->key[i],buffer);
+                                        }
+                                    } else
                                     {
-                                        case FIXED_LENGTH:
-                                            print_fixed_field('t',pf->f,buffer);
-                                            break;
-                                        case SEPARATED:
-                                            print_separated_field('t',s->quote,s->type[1],pf->f,buffer);
-                                            break;
-                                        case BINARY:
-                                            print_binary_field('t',pf->f,buffer);
-                                            break;
+                                        print_key_field(s,pf->f,buffer);
                                     }
                                     writec(0);
-                                    lookup_value = make_lookup(pf->f->lookup,field_start);
+                                    if(pf->f->lookup_cache != NULL)
+                                    {
+                                        lookup_len = (int) (write_pos - field_start) - 1;
+                                        lookup_value = value_cache_find(pf->f->lookup_cache,field_start,lookup_len,NULL);
+                                        if(lookup_value == NULL)
+                                        {
+                                            lookup_value = make_lookup(pf->f->lookup,field_start);
+                                            lookup_value = value_cache_store(pf->f->lookup_cache,field_start,lookup_len,lookup_value,strlen(lookup_value));
+                                        }
+                                    } else
+                                    {
+                                        lookup_value = make_lookup(pf->f->lookup,field_start);
+                                    }
                                     write_pos = field_start;  // restore write buffer
                                 }
                             } else if(lookup_value ==  NULL)
@@ -2113,34 +2881,17 @@ print_fields(struct structure *s, struct record *r,uint8_t *buffer)
                 }
             }
             writec(0);    // end of data marker
-        }
-        pf = pf->next;
-    }
-
-    pf = r->pf;
-
-    /* count the number of fields to be printed */
-    /* we need this before hand, because we must know if the is att least */
-    /* one field to be printed, then all separators must be printed */
-    while(pf != NULL) 
-    {
-        o = pf->f->o ? pf->f->o : r->o;
 
-        if(o != no_output)
-        {
-            if(o->print_empty || !pf->empty)
-            {
-                retval++;
-            }
+            /* count the number of fields to be printed */
+            /* we need this before hand, because we must know if the is att least */
+            /* one field to be printed, then all separators must be printed */
+            if(o->print_empty || !pf->empty) retval++;
         }
-        pf = pf->next;
     }
 
-    pf = r->pf;
-
-    while(pf != NULL && retval)
+    for(pf = r->pf;pf < pf_end && retval;pf++)
     {
-        o = pf->f->o ? pf->f->o : r->o;
+        o = pf->o;
 
         if(o != no_output)
         {
@@ -2179,9 +2930,8 @@ print_fields(struct structure *s, struct record *r,uint8_t *buffer)
                 }
                 fputs(pf->data,output_fp);
             }
-            if(pf->next != NULL && separator != NULL) fputs(separator,output_fp);
+            if(pf + 1 < pf_end && separator != NULL) fputs(separator,output_fp);
         }
-        pf = pf->next;
     }
     return retval;
 }
@@ -2258,6 +3008,35 @@ make_print_list(struct include_field *fl,struct field *f)
     return ret;
 }
 
+/* copy the print list of record r to one array,
+   output and data text of each field are resolved */
+static struct print_field *
+make_print_plan(struct record *r,struct print_field *list)
+{
+    struct print_field *plan,*pf,*next;
+    int i = 0;
+
+    r->pf_count = 0;
+    for(pf = list;pf != NULL;pf = pf->next) r->pf_count++;
+    if(!r->pf_count) return NULL;
+
+    plan = xmalloc(r->pf_count * sizeof(struct print_field));
+
+    pf = list;
+    while(pf != NULL)
+    {
+        plan[i].f = pf->f;
+        plan[i].o = pf->f->o ? pf->f->o : r->o;
+        plan[i].directives = pf->f->lookup != NULL ? plan[i].o->lookup : plan[i].o->data;
+        plan[i].next = i + 1 < r->pf_count ? &plan[i + 1] : NULL;
+        next = pf->next;
+        free(pf);
+        pf = next;
+        i++;
+    }
+    return plan;
+}
+
 /* check that all fields we found from current structure */
 /* return the count of unmatched fields */
 int
@@ -2297,6 +3076,8 @@ init_structure(struct structure *s,struct record *current_record,int length, uin
             if(s->header && f->name == NULL) 
                 f->name = xstrdup(get_separated_field(f->position,s->quote,s->type,buffer));
 
+            f->decoder = s->type[0] == BINARY ? bind_decoder(f) : DEC_NONE;
+
             rep = replace;
             while(rep != NULL)
             {
@@ -2327,7 +3108,10 @@ init_structure(struct structure *s,struct record *current_record,int length, uin
 
     while(r != NULL)
     {
-        if(r->o != no_output) r->pf = make_print_list(r->o->fl,r->f);
+        if(r->o != no_output) r->pf = make_print_plan(r,make_print_list(r->o->fl,r->f));
+        f = r->f;
+        while(f != NULL && f->next != NULL) f = f->next;
+        r->last_field = f;
         r = r->next;
     }
 
@@ -2376,207 +3160,217 @@ invalid_input(char *file, long int lineno,int strict,int length,int stype)
 }
 
 
+/* scan all values of expression, used for contains and regular expressions */
 static int
-hash_scan_expression(struct expr_list **list,char *value,int casecmp)
-{
-	register struct expr_list *l = list[hash(value,0)];
-
-	while(l != NULL)
-	{
-		if(casecmp)
-		{
-			if(strcasecmp(l->value,value) == 0) return 1;
-		} else
-		{
-			if(strcmp(l->value,value) == 0) return 1;
-		}
-                l = l->next;
-	}
-        return 0;
-} 
-    
-static int
-hash_scan_expression_len(struct expr_list **list,char *value,int casecmp,size_t comp_len)
-{
-	register struct expr_list *l = list[hash(value,comp_len)];
-
-	while(l != NULL)
-	{
-		if(casecmp)
-		{
-			if(strncasecmp(l->value,value,l->value_len) == 0) return 1;
-		} else
-		{
-			if(strncmp(l->value,value,l->value_len) == 0) return 1;
-		}
-                l = l->next;
-	}
-        return 0;
-} 
-
-static inline int
-scan_expression_list(struct expr_list *l,char *value,char op,int casecmp)
+full_scan_expression(struct expression *e,char *value,int casecmp)
 {
-    while(l != NULL)
+    register uint8_t *v = hash_table_next(e->values,NULL);
+#ifdef HAVE_REGEX
+    register int i = 0;
+#endif
+
+    while(v != NULL)
     {
-        switch(op)
+        switch(e->op)
         {
-            case OP_START:
-                if(casecmp)
-                {
-                    if(strncasecmp(l->value,value,l->value_len) == 0) return 1;
-                } else
-                {
-                    if(strncmp(l->value,value,l->value_len) == 0) return 1;
-                }
-                break;
-            case OP_EQUAL:
-            case OP_NOT_EQUAL:
-                if(casecmp)
-                {
-                    if(strcasecmp(l->value,value) == 0) return 1;
-                } else
-                {
-                    if(strcmp(l->value,value) == 0) return 1;
-                }
-                break;
             case OP_CONTAINS:
                 if(casecmp)
                 {
-                    if(strcasestr(value,l->value) != NULL) return 1;
+                    if(strcasestr(value,v) != NULL) return 1;
                 } else
                 {
-                    if(strstr(value,l->value) != NULL) return 1;
+                    if(strstr(value,v) != NULL) return 1;
                 }
                 break;
 #ifdef HAVE_REGEX
             case OP_REQEXP:
-                if(regexec(&l->reg,value,(size_t) 0, NULL, 0) == 0) return 1;
+                if(regexec(&e->reg[i++],value,(size_t) 0, NULL, 0) == 0) return 1;
                 break;
 #endif
         }
-        l = l->next;
+        v = hash_table_next(e->values,v);
     }
     return 0;
-}
+} 
 
+#define EXPR_UNKNOWN -1    /* result of a comparison of a missing field */
+
+/* evaluate a single expression for a field in current record */
 static int
-full_scan_expression(struct expression *e,char *value,int casecmp)
+eval_leaf(struct structure *s,struct record *r,struct expression *e,int casecmp,uint8_t *buffer)
 {
-    register int i = 0;
+    int retval = 0;
+    struct output *o;
+    size_t len,value_len;
 
+    if(e->f == NULL) return EXPR_UNKNOWN;    /* field is not in the current record */
 
-    if(e->fast_entries)
+    o = e->f->o ? e->f->o : r->o;
+    if(o != no_output && o->hex_cap)
     {
-        while(i < e->fast_entries)
-        {
-            if(scan_expression_list(e->expr_hash[e->fast_expr_hash[i]],value,e->op,casecmp)) return 1;
-            i++;
-        }
+        bcd_to_ascii = bcd_to_ascii_cap;
+        hex_to_ascii = hex_to_ascii_cap;
     } else
     {
-        while(i < MAX_EXPR_HASH)
-        {
-            if(scan_expression_list(e->expr_hash[i],value,e->op,casecmp)) return 1;
-            i++;
-        }
+        bcd_to_ascii = bcd_to_ascii_low;
+        hex_to_ascii = hex_to_ascii_low;
     }
-    return 0;
-} 
-
-/* returns true if and = 0 and attleast one expression is true 
- * or and = 1 and all expressions are true
- */
-int
-eval_expression(struct structure *s,struct record *r, int and,int invert, int casecmp, uint8_t *buffer)
-{
-    struct expression *e = expression;
-    int retval = 0;
-    int prev_retval;
-    int loop_break = 0;
-    int expression_count = 0;
-    struct output *o;
-    size_t len;
 
-    if(e == NULL) return 0;
-
-    while(e != NULL && !loop_break)
+    start_write();
+    switch(s->type[0])
     {
-        if(e->f != NULL)
-        {
+        case FIXED_LENGTH:
+            print_fixed_field('d',e->f,buffer);
+            break;
+        case SEPARATED:
+            print_separated_field('d',s->quote,s->type[1],e->f,buffer);
+            break;
+        case BINARY:
+            print_binary_field('d',e->f,buffer);
+            break;
+    }
+    writec(0);  // end of string
 
-            o = e->f->o ? e->f->o : r->o;
-            if(o != no_output && o->hex_cap)
+    switch(e->op)
+    {
+        case OP_START:
+            value_len = (size_t) (write_pos - write_buffer) - 1;
+            len = e->exp_max_len < value_len ? e->exp_max_len : value_len;
+            while(len >= e->exp_min_len && !retval)
             {
-                bcd_to_ascii = bcd_to_ascii_cap;
-                hex_to_ascii = hex_to_ascii_cap;
-            } else
-            {
-                bcd_to_ascii = bcd_to_ascii_low;
-                hex_to_ascii = hex_to_ascii_low;
+                retval = hash_table_find(e->values,write_buffer,len) != NULL;
+                if(!len) break;
+                len--;
             }
+            break;
+        case OP_CONTAINS:
+        case OP_REQEXP:
+            retval = full_scan_expression(e,write_buffer,casecmp);
+            break;
+        case OP_EQUAL:
+            retval = hash_table_find(e->values,write_buffer,(size_t) (write_pos - write_buffer) - 1) != NULL;
+            break;
+        case OP_NOT_EQUAL:
+            retval = hash_table_find(e->values,write_buffer,(size_t) (write_pos - write_buffer) - 1) == NULL;
+            break;
+    } 
+    return retval;
+}
+
+/* children are evaluated in the order of increasing rank: cost divided
+   by the probability that the child decides the result of the node
+ */
+#define EXPR_REORDER_INTERVAL 4096
+
+static double
+expression_hit_rate(struct expr_node *n)
+{
+    return ((double) n->hits + 1.0) / ((double) n->evals + 2.0);
+}
 
+static double
+expression_rank(char type,struct expr_node *n)
+{
+    double p = expression_hit_rate(n);
 
-            start_write();
-            switch(s->type[0])
+    return n->cost / (type == EN_AND ? 1.0 - p : p);
+}
+
+/* sort children of and/or node and update the cost of the node */
+void
+order_expression_node(struct expr_node *n)
+{
+    register int i,j;
+    struct expr_node *c;
+    double reach = 1.0,p;
+
+    switch(n->type)
+    {
+        case EN_AND:
+        case EN_OR:
+            for(i = 1;i < n->children;i++)
             {
-                case FIXED_LENGTH:
-                    print_fixed_field('d',e->f,buffer);
-                    break;
-                case SEPARATED:
-                    print_separated_field('d',s->quote,s->type[1],e->f,buffer);
-                    break;
-                case BINARY:
-                    print_binary_field('d',e->f,buffer);
-                    break;
+                c = n->child[i];
+                j = i - 1;
+                while(j >= 0 && expression_rank(n->type,n->child[j]) > expression_rank(n->type,c))
+                {
+                    n->child[j + 1] = n->child[j];
+                    j--;
+                }
+                n->child[j + 1] = c;
             }
-            writec(0);  // end of string
-            prev_retval = retval;
 
-            switch(e->op)
+            n->cost = 0;
+            for(i = 0;i < n->children;i++)
             {
-                case OP_START:
-                    len = e->exp_max_len;
-                    prev_retval = retval;
-                    while(len >= e->exp_min_len && prev_retval == retval)
-                    {
-                        retval += hash_scan_expression_len(e->expr_hash,write_buffer,casecmp,len);
-                        len--;
-                    }
-                    break;
-                case OP_CONTAINS:
-                case OP_REQEXP:
-                    retval += full_scan_expression(e,write_buffer,casecmp);
-                    break;
-                case OP_EQUAL:
-                    retval += hash_scan_expression(e->expr_hash,write_buffer,casecmp);
-                    break;
-                case OP_NOT_EQUAL:
-                    if(hash_scan_expression(e->expr_hash,write_buffer,casecmp) == 0) retval++;
-                    break;
-            } 
-        }
-        if(!and && retval)
-        {
-            loop_break = 1;
-        }
-        expression_count++;
-        if(and && retval != expression_count)
-        {
-            loop_break = 1;
-        }
-        e = e->next;
+                n->cost += reach * n->child[i]->cost;
+                p = expression_hit_rate(n->child[i]);
+                reach *= n->type == EN_AND ? p : 1.0 - p;
+            }
+            break;
+        case EN_NOT:
+            n->cost = n->child[0]->cost;
+            break;
     }
-    if(and)
+    n->since_reorder = 0;
+}
+
+/* comparison of a field missing from the record is unknown (EXPR_UNKNOWN),
+   and is false if any child is false, or is true if any child is true,
+   otherwise an unknown child makes the result unknown. not of unknown is
+   unknown and an unknown expression does not select the record
+ */
+static int
+eval_node(struct expr_node *n,struct structure *s,struct record *r,int casecmp,uint8_t *buffer)
+{
+    register int i;
+    int retval = 0;
+    int child;
+
+    switch(n->type)
     {
-        if (retval == expression_count)
-        {
+        case EN_LEAF:
+            retval = eval_leaf(s,r,n->e,casecmp,buffer);
+            break;
+        case EN_AND:
             retval = 1;
-        } else
-        {
-            retval = 0;
-        }
+            for(i = 0;i < n->children && retval;i++)
+            {
+                child = eval_node(n->child[i],s,r,casecmp,buffer);
+                if(child != 1) retval = child;
+            }
+            break;
+        case EN_OR:
+            for(i = 0;i < n->children && retval != 1;i++)
+            {
+                child = eval_node(n->child[i],s,r,casecmp,buffer);
+                if(child) retval = child;
+            }
+            break;
+        case EN_NOT:
+            retval = eval_node(n->child[0],s,r,casecmp,buffer);
+            if(retval != EXPR_UNKNOWN) retval = !retval;
+            break;
     }
+
+    n->evals++;
+    if(retval == 1) n->hits++;
+    if(n->children > 1 && ++n->since_reorder >= EXPR_REORDER_INTERVAL) order_expression_node(n);
+
+    return retval;
+}
+
+/* returns true if the expression tree evaluates true for the current record
+ */
+int
+eval_expression(struct structure *s,struct record *r,int invert, int casecmp, uint8_t *buffer)
+{
+    int retval;
+
+    if(expression_tree == NULL) return 0;
+
+    retval = eval_node(expression_tree,s,r,casecmp,buffer) == 1;
+
     if(invert) retval = !retval;
     return retval;
 }
@@ -2661,19 +3455,647 @@ select_output(struct output *o)
 }
 
 
+/* Batched filters: input lines are read ahead and the values for batched
+   filters are collected from them. Each filter is started once for all the
+   values, values are written one per line and the same number of lines is read back.
+ */
+struct batch_line {
+    uint8_t *data;
+    size_t size;
+    int length;
+    char *file_name;
+    long int file_lineno;
+    long int total_lineno;
+};
+
+static struct batch_line *batch = NULL;
+static int batch_lines = 0;         /* lines to read ahead, 0 = no batched filters in use */
+static int batch_count = 0;
+static int batch_next = 0;
+static uint8_t *batch_output = NULL;
+static size_t batch_output_size = 0;
+
+/* returns the lines to read ahead, the smallest batch size of the batched filters used */
+static int
+init_batch(struct structure *s)
+{
+    struct record *r = s->r;
+    struct field *f;
+    int lines = 0;
+
+    if(s->type[0] == BINARY) return 0;
+
+    while(r != NULL)
+    {
+        f = r->f;
+        while(f != NULL)
+        {
+            if(f->p != NULL && f->p->batch && (!lines || f->p->batch < lines)) lines = f->p->batch;
+            f = f->next;
+        }
+        r = r->next;
+    }
+
+    if(lines)
+    {
+        batch = xmalloc(lines * sizeof(struct batch_line));
+        memset(batch,0,lines * sizeof(struct batch_line));
+    }
+    return lines;
+}
+
+static void
+collect_batch_values(struct structure *s,struct record *r,int length,uint8_t *line)
+{
+    struct field *f = r->f;
+    uint8_t *value;
+    int len;
+
+    update_field_positions(s->type,s->quote,r,length,line);
+
+    while(f != NULL)
+    {
+        if(f->p != NULL && f->p->batch && f->const_data == NULL && f->bposition >= 0)
+        {
+            value = &line[f->bposition];
+            if(s->type[0] == SEPARATED)
+            {
+                len = (int) (separated_pipe_input_end(value,s->quote,s->type[1]) - value);
+            } else
+            {
+                len = f->length;
+                /* piped values are translated as in print_fixed_field */
+                if(input_decode != NULL && (s->type[0] == FIXED_LENGTH || f->type == F_ASC)) value = decode_field(value,len);
+            }
+            if(len > 0 && (f->p->mode == PIPE_LENGTH || memchr(value,'\n',len) == NULL)) hash_table_add(f->p->batch_values,value,len,NULL);
+        }
+        f = f->next;
+    }
+}
+
+/* run a batched filter for all collected values */
+static void
+run_batch(struct pipe *p)
+{
+#if defined(HAVE_WORKING_FORK) && defined(HAVE_DUP2) && defined(HAVE_PIPE)
+    int in_fds[2];
+    int out_fds[2];
+    pid_t pid;
+    FILE *rfd,*wfd;
+    uint8_t *v;
+    size_t len;
+    int c;
+
+    hash_table_clear(p->batch_results);
+    if(!p->batch_values->count) return;
+
+    if (pipe(in_fds) != 0 || pipe(out_fds) != 0) panic("Cannot create pipe",strerror(errno),NULL);
+    fflush(NULL);
+    pid = fork();
+    if(pid == (pid_t) 0) /* Child */
+    {
+        close(in_fds[1]);
+        close(out_fds[0]);
+        if(dup2(in_fds[0],STDIN_FILENO) == -1) panic("dup2 error",strerror(errno),NULL);
+        close(in_fds[0]);
+        if(dup2(out_fds[1],STDOUT_FILENO) == -1) panic("dup2 error",strerror(errno),NULL);
+        close(out_fds[1]);
+        if(execl(SHELL_CMD, "sh", "-c", p->command, NULL) == -1) panic("Starting a shell with execl failed",p->command,strerror(errno));
+        _exit(EXIT_SUCCESS);
+    } else if(pid < (pid_t) 0)
+    {
+        panic("Cannot fork",strerror(errno),NULL);
+    }
+    close(in_fds[0]);
+    close(out_fds[1]);
+
+    /* values are written by another child, so the command cannot block when ffe is not reading */
+    pid = fork();
+    if(pid == (pid_t) 0)
+    {
+        close(out_fds[0]);
+        wfd = fdopen(in_fds[1],"w");
+        if(wfd == NULL) _exit(EXIT_FAILURE);
+        v = hash_table_next(p->batch_values,NULL);
+        while(v != NULL)
+        {
+            if(fwrite(v,hash_table_key_len(v),1,wfd) != 1 || putc('\n',wfd) == EOF) _exit(EXIT_FAILURE);
+            v = hash_table_next(p->batch_values,v);
+        }
+        fclose(wfd);
+        _exit(EXIT_SUCCESS);
+    } else if(pid < (pid_t) 0)
+    {
+        panic("Cannot fork",strerror(errno),NULL);
+    }
+    close(in_fds[1]);
+
+    rfd = fdopen(out_fds[0],"r");
+    if(rfd == NULL) panic("Cannot read from command",p->command,strerror(errno));
+
+    v = hash_table_next(p->batch_values,NULL);
+    while(v != NULL)
+    {
+        len = 0;
+        while((c = getc(rfd)) != EOF && c != '\n')
+        {
+            if(len + 1 >= batch_output_size)
+            {
+                batch_output_size = batch_output_size ? 2 * batch_output_size : 1024;
+                batch_output = xrealloc(batch_output,batch_output_size);
+            }
+            batch_output[len++] = (uint8_t) c;
+        }
+        if(c == EOF && !len) panic("Filter command returned less lines than it was given",p->command,NULL);
+        if(batch_output == NULL) batch_output = xmalloc(batch_output_size = 1024);
+        batch_output[len] = 0;
+        hash_table_add(p->batch_results,v,hash_table_key_len(v),batch_output);
+        v = hash_table_next(p->batch_values,v);
+    }
+    fclose(rfd);
+#endif
+    hash_table_clear(p->batch_values);
+}
+
+/* write all collected values to a persistent filter before reading the replies */
+static void
+run_persistent_batch(struct pipe *p)
+{
+#if defined(HAVE_WORKING_FORK) && defined(HAVE_DUP2) && defined(HAVE_PIPE) && defined(HAVE_POLL_H)
+    uint8_t *v;
+    size_t start,next;
+    long len;
+    int count = 0;
+
+    hash_table_clear(p->batch_results);
+    if(!p->batch_values->count) return;
+
+    if(p->wfd == -1) start_persistent_pipe(p);
+
+    v = hash_table_next(p->batch_values,NULL);
+    while(v != NULL)
+    {
+        persistent_request(p,v,hash_table_key_len(v));
+        count++;
+        v = hash_table_next(p->batch_values,v);
+    }
+    persistent_exchange(p,count);
+
+    /* replies are in the same order as the values were written */
+    v = hash_table_next(p->batch_values,NULL);
+    while(v != NULL)
+    {
+        len = persistent_reply(p,p->rpos,&start,&next);
+        if((size_t) len + 1 > batch_output_size)
+        {
+            batch_output_size = (size_t) len + 1024;
+            batch_output = xrealloc(batch_output,batch_output_size);
+        }
+        memcpy(batch_output,&p->rbuf[start],(size_t) len);
+        batch_output[len] = 0;
+        /* results are kept as strings, a reply containing zero is asked again when it is used */
+        if(memchr(batch_output,0,(size_t) len) == NULL) hash_table_add(p->batch_results,v,hash_table_key_len(v),batch_output);
+        p->rpos = next;
+        v = hash_table_next(p->batch_values,v);
+    }
+#endif
+    hash_table_clear(p->batch_values);
+}
+
+/* read next lines ahead and run the batched filters */
+static void
+fill_batch(struct structure *s,int prefilter)
+{
+    struct batch_line *b;
+    struct record *r;
+    struct pipe *p;
+    uint8_t *line;
+    int length;
+
+    batch_count = 0;
+    batch_next = 0;
+
+    while(batch_count < batch_lines && (line = get_input_line(&length,s->type[0])) != NULL)
+    {
+        b = &batch[batch_count++];
+        if((size_t) length + 2 > b->size)
+        {
+            b->size = (size_t) length + 128;
+            b->data = xrealloc(b->data,b->size);
+        }
+        memcpy(b->data,line,length);
+        b->data[length] = '\n';
+        b->data[length + 1] = 0;
+        b->length = length;
+        b->file_name = current_file_name;
+        b->file_lineno = current_file_lineno;
+        b->total_lineno = current_total_lineno;
+
+        if(prefilter && !prefilter_line(b->data,length)) continue;
+
+        r = select_record(s,length,b->data);
+        if(r != NULL) collect_batch_values(s,r,length,b->data);
+    }
+
+    p = pipes;
+    while(p != NULL)
+    {
+        if(p->mode == PIPE_BATCH)
+        {
+            run_batch(p);
+        } else if(p->batch)
+        {
+            run_persistent_batch(p);
+        }
+        p = p->next;
+    }
+}
+
+/* returns the next line read ahead */
+static uint8_t *
+get_batched_line(int *len,struct structure *s,int prefilter)
+{
+    struct batch_line *b;
+
+    if(batch_next == batch_count) fill_batch(s,prefilter);
+    if(batch_next == batch_count) return NULL;
+
+    b = &batch[batch_next++];
+    current_file_name = b->file_name;
+    current_file_lineno = b->file_lineno;
+    current_total_lineno = b->total_lineno;
+    *len = b->length;
+    return b->data;
+}
+
+#if defined(HAVE_WORKING_FORK) && defined(HAVE_PIPE) && defined(HAVE_SIGACTION) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_SYS_STAT_H)
+/* Parallel anonymizing copy.
+ * When all records are printed raw, input files are divided in chunks
+ * of PARALLEL_CHUNK bytes which are processed by worker processes in turns:
+ * worker n takes chunks n, n + jobs, n + 2 * jobs...
+ * A chunk contains the lines starting inside it. Lines are anonymized
+ * in place and the chunk is written with one write when the worker gets
+ * the turn. The turn is passed in a ring of pipes, the turn message contains
+ * the line number of the file, so invalid lines are reported as in serial run.
+ * Fixed length records without LF are split at record boundaries, chunk
+ * length is then a multiple of the record length.
+ */
+#define PARALLEL_CHUNK (8 * 1024 * 1024)
+
+static off_t parallel_chunk = PARALLEL_CHUNK;
+
+struct parallel_file {
+    char *name;
+    off_t size;
+    long chunks;
+};
+
+struct invalid_line {
+    long lineno;
+    int length;
+};
+
+static struct parallel_file *parallel_files;
+static int parallel_file_count;
+
+/* check if input and output allow parallel processing, parallel files are collected */
+static int
+parallel_possible(struct structure *s,int debug)
+{
+    struct input_file *f = files;
+    struct record *r = s->r;
+    struct stat st;
+    int i = 0;
+
+    /* lines before the first valid line are already reported */
+    if(s->type[0] == BINARY || expression != NULL || debug || current_total_lineno != 1) return 0;
+    if(s->framing == FRAME_RDW || s->framing == FRAME_BDW) return 0;
+    if(s->o != raw && s->o != no_output && s->o->file_trailer != NULL) return 0;
+    if(ffe_open != NULL && ffe_open[0]) return 0;
+
+    while(r != NULL)
+    {
+        if(r->o != raw && r->o != no_output) return 0;
+        r = r->next;
+    }
+
+    while(f != NULL)
+    {
+        if(strcmp(f->name,"(stdin)") == 0 || strcmp(f->name,"-") == 0) return 0;
+        if(stat(f->name,&st) || !S_ISREG(st.st_mode)) return 0;
+        i++;
+        f = f->next;
+    }
+
+    parallel_file_count = i;
+    parallel_files = xmalloc(i * sizeof(struct parallel_file));
+    if(s->framing == FRAME_FIXED) parallel_chunk = (PARALLEL_CHUNK / s->record_length) * s->record_length;
+
+    f = files;
+    i = 0;
+    while(f != NULL)
+    {
+        stat(f->name,&st);
+        parallel_files[i].name = f->name;
+        parallel_files[i].size = st.st_size;
+        parallel_files[i].chunks = (long) ((st.st_size + parallel_chunk - 1) / parallel_chunk);
+        i++;
+        f = f->next;
+    }
+    return 1;
+}
+
+/* read lines starting between start and end to buffer, the data begins at *data.
+   Returns the data length */
+static size_t
+read_chunk(FILE *fp,char *file,off_t start,off_t end,uint8_t **buffer,size_t *size,size_t *data)
+{
+    off_t from = start ? start - 1 : 0;
+    size_t len = (size_t) (end - from);
+    size_t got;
+    uint8_t *p;
+
+    if(len + 2 > *size)
+    {
+        *size = len + 65536;
+        *buffer = xrealloc(*buffer,*size);
+    }
+
+    if(input_framing == FRAME_FIXED)    /* chunk starts and ends at record boundary */
+    {
+        from = start;
+        len = (size_t) (end - start);
+    }
+
+    if(fseeko(fp,from,SEEK_SET) || fread(*buffer,1,len,fp) != len) panic("Error reading",file,strerror(errno));
+
+    *data = 0;
+    if(input_framing == FRAME_FIXED) return len;
+    if(start)   /* line started in previous chunk belongs to it */
+    {
+        p = memchr(*buffer,'\n',len);
+        if(p == NULL) return 0;
+        *data = (size_t) (p - *buffer) + 1;
+        if(*data == len) return 0;
+    }
+
+    while((*buffer)[len - 1] != '\n')  /* complete the last line */
+    {
+        if(len + 65536 + 2 > *size)
+        {
+            *size = len + 1024 * 1024;
+            *buffer = xrealloc(*buffer,*size);
+        }
+        got = fread(*buffer + len,1,65536,fp);
+        if(!got) break;
+        p = memchr(*buffer + len,'\n',got);
+        if(p != NULL)
+        {
+            len = (size_t) (p - *buffer) + 1;
+            break;
+        }
+        len += got;
+    }
+    return len - *data;
+}
+
+/* anonymize the lines of a chunk in place, lines not printed are removed.
+   Returns the length of the output */
+static size_t
+anonymize_chunk(struct structure *s,uint8_t *data,size_t len,int first_chunk,int skip_header,int strict,long *lines,
+                struct invalid_line **invalid,int *invalid_count,int *invalid_size)
+{
+    uint8_t *in = data,*out = data,*end = data + len,*lf;
+    uint8_t saved = 0;
+    struct record *r;
+    int length;
+
+    *lines = 0;
+    *invalid_count = 0;
+
+    while(in < end)
+    {
+        if(input_framing == FRAME_FIXED)
+        {
+            length = end - in < input_record_length ? (int) (end - in) : input_record_length;
+            lf = in + length;
+            saved = *lf;
+            *lf = '\n';
+        } else
+        {
+            lf = memchr(in,'\n',(size_t) (end - in));
+            if(lf == NULL)      /* last line without LF */
+            {
+                lf = end;
+                *lf = '\n';
+            }
+            length = (int) (lf - in);
+        }
+        (*lines)++;
+        current_file_lineno = first_chunk ? *lines : 0;
+
+        if(skip_header && *lines == 1)
+        {
+            r = NULL;
+        } else
+        {
+            r = select_record(s,length,in);
+            if(r == NULL)
+            {
+                if(*invalid_count == *invalid_size)
+                {
+                    *invalid_size += 64;
+                    *invalid = xrealloc(*invalid,*invalid_size * sizeof(struct invalid_line));
+                }
+                (*invalid)[*invalid_count].lineno = *lines;
+                (*invalid)[*invalid_count].length = length;
+                (*invalid_count)++;
+                if(strict) return (size_t) (out - data);    /* output is written up to the invalid line */
+            } else
+            {
+                update_field_positions(s->type,s->quote,r,length,in);
+                if(r->o == raw)
+                {
+                    anonymize_fields(s->type,s->quote,r,length,in);
+                    if(input_framing == FRAME_FIXED)
+                    {
+                        if(out != in) memmove(out,in,(size_t) length);
+                        out += length;
+                    } else
+                    {
+                        if(out != in) memmove(out,in,(size_t) length + 1);
+                        out += length + 1;
+                    }
+                }
+            }
+        }
+        if(input_framing == FRAME_FIXED)
+        {
+            *lf = saved;
+            in = lf;
+        } else
+        {
+            in = lf + 1;
+        }
+    }
+    return (size_t) (out - data);
+}
+
+static void
+parallel_worker(struct structure *s,int strict,int jobs,int n,int *ring)
+{
+    uint8_t *buffer = NULL;
+    size_t size = 0,data,len;
+    struct invalid_line *invalid = NULL;
+    int invalid_count,invalid_size = 0;
+    long chunk = n,c,lines,base;
+    int f,open_file = -1,i;
+    FILE *fp = NULL;
+    off_t start,end;
+    int next = (n + 1) % jobs;
+    ssize_t got;
+    struct sigaction act;
+
+    /* keep only the own turn pipe and the pipe of the next worker open, so
+       a worker reading its turn gets EOF if the previous worker has died */
+    for(i = 0;i < 2 * jobs;i++) if(i != 2 * n && i != 2 * next + 1) close(ring[i]);
+
+    anon_random_stream(n);
+
+    while(1)
+    {
+        c = chunk;
+        f = 0;
+        while(f < parallel_file_count && c >= parallel_files[f].chunks)
+        {
+            c -= parallel_files[f].chunks;
+            f++;
+        }
+        if(f == parallel_file_count) break;
+
+        if(open_file != f)
+        {
+            if(fp != NULL) fclose(fp);
+            fp = xfopen(parallel_files[f].name,"rb");
+            open_file = f;
+        }
+        current_file_name = parallel_files[f].name;
+
+        start = (off_t) c * parallel_chunk;
+        end = start + parallel_chunk;
+        if(end > parallel_files[f].size) end = parallel_files[f].size;
+
+        len = read_chunk(fp,current_file_name,start,end,&buffer,&size,&data);
+        len = anonymize_chunk(s,buffer + data,len,start == 0,start == 0 && (headers == HEADER_ALL || (headers && f == 0)),
+                              strict,&lines,&invalid,&invalid_count,&invalid_size);
+
+        got = read(ring[2 * n],&base,sizeof(base));
+        if(!got) _exit(EXIT_FAILURE);       /* an other worker has failed and reported the error */
+        if(got != sizeof(base)) panic("Error reading pipe",strerror(errno),NULL);
+        if(start == 0) base = 0;
+
+        if(len && fwrite(buffer + data,1,len,default_output_fp) != len) panic("Error writing to",default_output_file,NULL);
+        if(fflush(default_output_fp)) panic("Error writing to",default_output_file,strerror(errno));
+        for(i = 0;i < invalid_count;i++)
+            invalid_input(current_file_name,base + invalid[i].lineno,strict,invalid[i].length,s->type[0]);
+
+        base += lines;
+        if(write(ring[2 * next + 1],&base,sizeof(base)) != sizeof(base)) panic("Error writing pipe",strerror(errno),NULL);
+        chunk += jobs;
+    }
+
+    /* pass the turn, workers having later chunks have finished also.
+       The next worker may have exited already */
+    sigemptyset(&act.sa_mask);
+    act.sa_handler = SIG_IGN;
+    act.sa_flags = 0;
+    sigaction(SIGPIPE,&act,NULL);
+    if(read(ring[2 * n],&base,sizeof(base)) == sizeof(base))
+        if(write(ring[2 * next + 1],&base,sizeof(base)) == -1 && errno != EPIPE) panic("Error writing pipe",strerror(errno),NULL);
+    if(fp != NULL) fclose(fp);
+    fflush(NULL);
+    _exit(EXIT_SUCCESS);
+}
+
+/* start workers and wait them to finish. Returns 0 if parallel processing was not possible */
+static int
+parallel_anonymize(struct structure *s,int strict,int jobs,int debug)
+{
+    pid_t *pid,done;
+    int *ring;
+    int i,status,running,failed = 0;
+    long base = 0;
+    struct sigaction act,old_act;
+
+    if(!parallel_possible(s,debug)) return 0;
+
+    ring = xmalloc(2 * jobs * sizeof(int));
+    pid = xmalloc(jobs * sizeof(pid_t));
+    for(i = 0;i < jobs;i++) if(pipe(&ring[2 * i])) panic("Cannot create pipe",strerror(errno),NULL);
+
+    sigemptyset(&act.sa_mask);   /* workers are waited, they are not reaped automatically */
+    act.sa_handler = SIG_DFL;
+    act.sa_flags = 0;
+    sigaction(SIGCHLD,&act,&old_act);
+
+    fflush(NULL);
+    for(i = 0;i < jobs;i++)
+    {
+        pid[i] = fork();
+        if(pid[i] == (pid_t) 0) parallel_worker(s,strict,jobs,i,ring);
+        if(pid[i] < (pid_t) 0) panic("Cannot fork",strerror(errno),NULL);
+    }
+
+    if(write(ring[1],&base,sizeof(base)) != sizeof(base)) panic("Error writing pipe",strerror(errno),NULL);
+    for(i = 0;i < 2 * jobs;i++) close(ring[i]);
+
+    /* workers are waited in the order they finish, the rest are stopped when one fails */
+    running = jobs;
+    while(running)
+    {
+        done = waitpid(-1,&status,0);
+        if(done == (pid_t) -1)
+        {
+            if(errno == EINTR) continue;
+            failed = 1;
+            break;
+        }
+        i = 0;
+        while(i < jobs && pid[i] != done) i++;
+        if(i == jobs) continue;     /* not a worker */
+        pid[i] = (pid_t) 0;
+        running--;
+        if(!failed && (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS))
+        {
+            failed = 1;
+            for(i = 0;i < jobs;i++) if(pid[i]) kill(pid[i],SIGTERM);
+        }
+    }
+
+    sigaction(SIGCHLD,&old_act,NULL);
+    free(ring);
+    free(pid);
+    free(parallel_files);
+    if(failed) exit(EXIT_FAILURE);
+    return 1;
+}
+#endif
+
 /* main loop for execution */
 void 
-execute(struct structure *s,int strict, int expression_and,int expression_invert,int expression_case, int debug,char *anon_to_use)
+execute(struct structure *s,int strict,int expression_invert,int expression_case, int debug,char *anon_to_use,int jobs)
 {
     uint8_t *input_line;
     struct record *r = NULL;
     struct record *prev_record = NULL;
     int length;
+    size_t consumed;
     int header_printed = 0;
     int fields_printed;
     int first_line = 1;
     int i;
     int anon_field_count=0;
+    int prefilter = 0;
 
     current_file_lineno = 0;
     current_total_lineno = 0;
@@ -2688,17 +4110,24 @@ execute(struct structure *s,int strict, int expression_and,int expression_invert
     write_buffer = xmalloc(write_buffer_size);
     write_buffer_end = write_buffer + (write_buffer_size - 1);
 
+    input_decode = s->decode;
+    input_encode = s->encode;
+    input_framing = s->framing;
+    input_record_length = s->record_length;
+
     select_output(s->o);
     print_text(s,NULL,s->o->file_header);
-    while((input_line = get_input_line(&length,s->type[0])) != NULL)
+    while((input_line = batch_lines ? get_batched_line(&length,s,prefilter) : get_input_line(&length,s->type[0])) != NULL)
     {
+        if(prefilter && !prefilter_line(input_line,length)) continue;
+
         prev_record = r;
         r = select_record(s,length,input_line);
         if(r == NULL) 
         {
             if(debug) write_debug_file(input_line,length,s->type[0]);
             invalid_input(current_file_name,current_file_lineno,strict,length,s->type[0]);
-            if(s->type[0] == BINARY)
+            if(s->type[0] == BINARY && input_framing == FRAME_LF)
             {
                 last_consumed = 1; /* advance one byte and check next block, this is a rather expensive way to read ahead... */
             }
@@ -2711,6 +4140,18 @@ execute(struct structure *s,int strict, int expression_and,int expression_invert
                 anon_field_count = update_anon_info(s,anon_to_use);
                 if(anon_field_count) init_libgcrypt();
 
+#if defined(HAVE_WORKING_FORK) && defined(HAVE_PIPE) && defined(HAVE_SIGACTION) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_SYS_STAT_H)
+                if(jobs > 1 && anon_field_count && parallel_anonymize(s,strict,jobs,debug))
+                {
+                    free(write_buffer);
+                    return;
+                }
+#endif
+
+                /* invalid lines must be reported, so prefiltering is done only in loose mode */
+                if(!strict && !debug && !expression_invert && !expression_case) prefilter = init_prefilter(s);
+
+                batch_lines = init_batch(s);
             }
 
             if(expression != NULL && (prev_record != r || prev_record == NULL))
@@ -2718,18 +4159,19 @@ execute(struct structure *s,int strict, int expression_and,int expression_invert
                 init_expression_list(r);
             }
             
-            last_consumed = update_field_positions(s->type,s->quote,r,length,input_line);
+            consumed = update_field_positions(s->type,s->quote,r,length,input_line);
+            if(input_framing == FRAME_LF) last_consumed = consumed;   /* framed record is consumed as whole */
 
             if((!first_line || !headers) && r->o != no_output)
             {
                 if((r->pf == NULL && r->o->no_data == 1) || r->pf != NULL || r->o == raw)
                 {
-                    if(expression == NULL || (eval_expression(s,r,expression_and,expression_invert,expression_case,input_line)))
+                    if(expression == NULL || (eval_expression(s,r,expression_invert,expression_case,input_line)))
                     {
                         if(anon_field_count) anonymize_fields(s->type,s->quote,r,length,input_line);  // anonymize after exp. evaluation
                         if(r->o == raw)
                         {
-                            print_raw(s->type[0] == BINARY ? last_consumed : length,input_line,s->type[0]);
+                            print_raw(s->type[0] == BINARY && input_framing == FRAME_LF ? last_consumed : length,input_line,s->type[0]);
                         } else
                         {
                             select_output(r->o);
@@ -2764,6 +4206,11 @@ execute(struct structure *s,int strict, int expression_and,int expression_invert
     print_text(s,r,s->o->file_trailer);
     free(write_buffer);
     if(debug_fp != NULL) fclose(debug_fp);
+#if defined(HAVE_WORKING_FORK) && defined(HAVE_DUP2) && defined(HAVE_PIPE) && defined(HAVE_POLL_H)
+    close_persistent_pipes();
+#endif
+    print_pipe_cache_stats();
+    if(anon_field_count) print_anon_cache_stats();
 }
 
 
@@ -64,7 +64,7 @@ static char *email_address = PACKAGE_BUGREPORT;
 static char *email_address = "tjsa@iki.fi";
 #endif
 
-static char short_opts[] = "c:s:o:p:f:e:r:A:l?VavdIX";
+static char short_opts[] = "c:s:o:p:f:e:E:r:A:j:l?VavdIXBLC";
 
 #ifdef HAVE_GETOPT_LONG
 static struct option long_opts[] = {
@@ -75,6 +75,7 @@ static struct option long_opts[] = {
     {"field-list",1,NULL,'f'},
     {"loose",0,NULL,'l'},
     {"expression",1,NULL,'e'},
+    {"boolean-expression",1,NULL,'E'},
     {"help",0,NULL,'?'},
     {"version",0,NULL,'V'},
     {"and",0,NULL,'a'},
@@ -84,6 +85,10 @@ static struct option long_opts[] = {
     {"info",0,NULL,'I'},
     {"casecmp",0,NULL,'X'},
     {"anonymize",1,NULL,'A'},
+    {"jobs",1,NULL,'j'},
+    {"bloom-files",0,NULL,'B'},
+    {"build-lookup-index",0,NULL,'L'},
+    {"compile",0,NULL,'C'},
     {NULL,0,NULL,0}
 };
 #endif
@@ -104,6 +109,7 @@ char *ffe_open = NULL;
 struct structure *structure = NULL;
 struct output *output = NULL;
 struct expression *expression = NULL;
+struct expr_node *expression_tree = NULL;
 struct lookup *lookup = NULL;
 struct replace *replace = NULL;
 struct field *const_field = NULL;
@@ -208,10 +214,16 @@ help(FILE *stream)
     fprintf(stream,"\t\tPrint only fields and constants listed in comma separated list LIST.\n");
     fprintf(stream,"-e, --expression=EXPRESSION\n");
     fprintf(stream,"\t\tPrint only those records for which the EXPRESSION evaluates to true.\n");
+    fprintf(stream,"-E, --boolean-expression=EXPRESSION\n");
+    fprintf(stream,"\t\tPrint only those records for which the boolean EXPRESSION evaluates to true.\n");
     fprintf(stream,"-a, --and\n");
     fprintf(stream,"\t\tExpressions are combined with logical and, default is logical or.\n");
     fprintf(stream,"-X, --casecmp\n");
     fprintf(stream,"\t\tExpressions are evaluated case insensitive.\n");
+    fprintf(stream,"-B, --bloom-files\n");
+    fprintf(stream,"\t\tSave Bloom filters of large value and lookup files for later runs.\n");
+    fprintf(stream,"-L, --build-lookup-index\n");
+    fprintf(stream,"\t\tBuild index files of lookup tables from lookup files and exit.\n");
     fprintf(stream,"-v, --invert-match\n");
     fprintf(stream,"\t\tPrint only those records which don't match the expression.\n");
     fprintf(stream,"-l, --loose\n");
@@ -224,6 +236,10 @@ help(FILE *stream)
     fprintf(stream,"\t\tShow the structure information and exit.\n");
     fprintf(stream,"-A, --anonymize=ANONYMIZE\n");
     fprintf(stream,"\t\tUse anonymization ANONYMIZE to anomymize certain input fields.\n");
+    fprintf(stream,"-j, --jobs=N\n");
+    fprintf(stream,"\t\tAnonymize raw output using N parallel processes.\n");
+    fprintf(stream,"-C, --compile\n");
+    fprintf(stream,"\t\tWrite C source of a program printing the structure and exit.\n");
     fprintf(stream,"-?, --help\n");
     fprintf(stream,"\t\tDisplay this help and exit.\n");
     fprintf(stream,"-V, --version\n");
@@ -240,10 +256,16 @@ help(FILE *stream)
     fprintf(stream,"\t\tPrint only fields and constants listed in comma separated list LIST.\n");
     fprintf(stream,"-e EXPRESSION\n");
     fprintf(stream,"\t\tPrint only those records for which the EXPRESSION evaluates to true.\n");
+    fprintf(stream,"-E EXPRESSION\n");
+    fprintf(stream,"\t\tPrint only those records for which the boolean EXPRESSION evaluates to true.\n");
     fprintf(stream,"-a\n");
     fprintf(stream,"\t\tExpressions are combined with logical and, default is logical or.\n");
     fprintf(stream,"-X\n");
     fprintf(stream,"\t\tExpressions are evaluated case insensitive.\n");
+    fprintf(stream,"-B\n");
+    fprintf(stream,"\t\tSave Bloom filters of large value and lookup files for later runs.\n");
+    fprintf(stream,"-L\n");
+    fprintf(stream,"\t\tBuild index files of lookup tables from lookup files and exit.\n");
     fprintf(stream,"-v\n");
     fprintf(stream,"\t\tPrint only those records which don't match the expression.\n");
     fprintf(stream,"-l\n");
@@ -256,6 +278,10 @@ help(FILE *stream)
     fprintf(stream,"\t\tShow the structure information and exit.\n");
     fprintf(stream,"-A ANONYMIZE\n");
     fprintf(stream,"\t\tUse anonymization ANONYMIZE to anomymize certain input fields.\n");
+    fprintf(stream,"-j N\n");
+    fprintf(stream,"\t\tAnonymize raw output using N parallel processes.\n");
+    fprintf(stream,"-C\n");
+    fprintf(stream,"\t\tWrite C source of a program printing the structure and exit.\n");
     fprintf(stream,"-?\n");
     fprintf(stream,"\t\tDisplay this help and exit.\n");
     fprintf(stream,"-V\n");
@@ -283,29 +309,6 @@ print_version()
     printf("There is NO warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n");
 }
 
-size_t
-hash(char *str,size_t len)
-{
-    register unsigned long h = 5381;
-    int c;
-
-    if(len > 0)
-    {
-        while ((c = *str++) != 0 && len > 0)
-        {
-            h = ((h << 5) + h) + c;
-            len--;
-        }
-    }else
-    {
-        while ((c = *str++) != 0)
-        {
-            h = ((h << 5) + h) + c;
-        }
-    }
-    return (size_t) (h % MAX_EXPR_HASH);
-}
-
 /* update anonymization pointers to fields which should be anonymized
  * return the number of found fields
  */
@@ -407,6 +410,42 @@ find_structure(char *name)
     return NULL;
 }
 
+/* resolve the fields of a composite lookup key in record r */
+static int
+init_lookup_key(struct record *r,struct field *f)
+{
+    char *list,*name,*next;
+    struct field *kf;
+    int ok = 1;
+
+    f->key = NULL;
+    f->key_count = 0;
+    if(f->lookup->key_fields == NULL) return 1;
+
+    list = xstrdup(f->lookup->key_fields);
+    name = list;
+    while(name != NULL)
+    {
+        next = strchr(name,',');
+        if(next != NULL) *next++ = 0;
+
+        kf = r->f;
+        while(kf != NULL && (kf->name == NULL || strcmp(kf->name,name) != 0)) kf = kf->next;
+        if(kf == NULL)
+        {
+            fprintf(stderr,"%s: Key field \'%s\' of lookup \'%s\' is not in record \'%s\'\n",program,name,f->lookup->name,r->name);
+            ok = 0;
+        } else
+        {
+            f->key = xrealloc(f->key,(f->key_count + 1) * sizeof(struct field *));
+            f->key[f->key_count++] = kf;
+        }
+        name = next;
+    }
+    free(list);
+    return ok;
+}
+
 /* check structure and output integrity */
 /* and initialize some things */
 void 
@@ -417,6 +456,7 @@ check_rc(char *use_output)
     struct record *r,*fr;
     struct field *f;
     struct lookup *l;
+    struct id *i;
     int several_records = 0;
     int errors = 0;
     int ordinal;
@@ -471,6 +511,15 @@ check_rc(char *use_output)
             errors++;
             fprintf(stderr,"%s: Headers are valid only in separated input, structure \'%s\'\n",program,s->name);
         }
+        if(s->decode != NULL)
+        {
+            if(s->type[0] == SEPARATED)
+            {
+                errors++;
+                fprintf(stderr,"%s: Code page can be used only in fixed length and binary structures, structure \'%s\'\n",program,s->name);
+            }
+            s->encode = code_page_encoder(s->decode);
+        }
 
         field_count_first = 0;
 
@@ -493,6 +542,23 @@ check_rc(char *use_output)
                 fprintf(stderr,"%s: Every record in a binary multi-record structure must have an id, structure \'%s\', record \'%s\'\n",program,s->name,r->name);
             }
 
+            if(s->encode != NULL)  /* ids are given as text, match them against raw input */
+            {
+                i = r->i;
+                while(i != NULL)
+                {
+                    if(i->regexp)
+                    {
+                        errors++;
+                        fprintf(stderr,"%s: Regular expression ids cannot be used with code page, structure \'%s\', record \'%s\'\n",program,s->name,r->name);
+                    } else
+                    {
+                        translate(s->encode,i->key,i->length);
+                    }
+                    i = i->next;
+                }
+            }
+
             if(r->fields_from != NULL)
             {
                 if(r->f != NULL)
@@ -587,6 +653,8 @@ check_rc(char *use_output)
                         if(strcmp(l->name,f->lookup_table_name) == 0)
                         {
                             f->lookup = l;
+                            f->lookup_cache = l->cache_size ? new_value_cache(l->cache_size) : NULL;
+                            if(!init_lookup_key(r,f)) errors++;
                         }
                         l = l->next;
                     }
@@ -709,37 +777,14 @@ add_replace(char *optarg)
 }
 
 
-/* adds an item to expression hash list 
-    */
-static void
-add_expression_to_list(struct expr_list **list, char *value)
-{
-    size_t h = hash(value,0);
-    register struct expr_list *e = list[h];
-
-    if(e == NULL)
-    {
-        e = xmalloc(sizeof(struct expr_list));
-        list[h] = e;
-    } else
-    {
-        while(e->next != NULL) e = e->next;
-        e->next = xmalloc(sizeof(struct expr_list));
-        e = e->next;
-    }
-    e->value = xstrdup(value);
-    e->value_len = strlen(e->value);
-    e->next = NULL;
-}
-
-
 static void
-read_expression_file(struct expr_list **list, char *file)
+read_expression_file(struct expression *e, char *file)
 {
     FILE *fp;
     register int ccount;
     size_t line_len = 1024;
     char *line = xmalloc(line_len);
+    size_t before = e->values->count;
 
     fp = xfopen(file,"r");
 
@@ -759,160 +804,452 @@ read_expression_file(struct expr_list **list, char *file)
         if (ccount > 1)
         {
             line[ccount - 1] = 0;
-            add_expression_to_list(list,line);
+            e->value_count += hash_table_add(e->values,line,ccount - 1,NULL);
         }
     }
     while(ccount != -1);
     fclose(fp);
     free(line);
+    hash_table_source(e->values,file,before);
 }
 
-static void
-init_expr_hash(struct expr_list **list)
+/* returns the expression operator found in optarg, op_pos will point to it */
+static char
+find_expression_op(char *optarg,char **op_pos)
 {
-    register int i = 0;
-
-    while(i < MAX_EXPR_HASH) list[i++] = NULL;
-}
-
-
-void
-add_expression(char *optarg)
-{
-    char *op_pos;
     char op = 0;
-    struct expression *e,*last;
-    int found = 0;
-    char *value_file;
 
-    if((op_pos = strchr(optarg,OP_REQEXP)) != NULL)
+    if((*op_pos = strchr(optarg,OP_REQEXP)) != NULL)
     {
 #ifdef HAVE_REGEX
         op = OP_REQEXP;    
 #else
         panic("Regular expressions are not supported in this system",optarg,NULL);
 #endif
-    } else if((op_pos = strchr(optarg,OP_EQUAL)) != NULL)
+    } else if((*op_pos = strchr(optarg,OP_EQUAL)) != NULL)
     {
         op = OP_EQUAL;
-    } else if((op_pos = strchr(optarg,OP_START)) != NULL)
+    } else if((*op_pos = strchr(optarg,OP_START)) != NULL)
     {
         op = OP_START;
-    } else if((op_pos = strchr(optarg,OP_CONTAINS)) != NULL)
+    } else if((*op_pos = strchr(optarg,OP_CONTAINS)) != NULL)
     {
         op = OP_CONTAINS;
-    } else if((op_pos = strchr(optarg,OP_NOT_EQUAL)) != NULL)
+    } else if((*op_pos = strchr(optarg,OP_NOT_EQUAL)) != NULL)
     {
         op = OP_NOT_EQUAL;
     } else
     {
         panic("Expression must contain an operator: =,^,~,? or !",optarg,NULL);
     }
+    return op;
+}
+
+/* make a new expression and add it to the end of expression list */
+static struct expression *
+new_expression(char *field,char op,int tree)
+{
+    struct expression *e,*last;
+
+    e = xmalloc(sizeof(struct expression));
+    e->next = NULL;
+    e->field = xstrdup(field);
+    e->op = op;
+    e->found = 0;
+    e->tree = tree;
+    e->value_count = 0;
+    e->exp_min_len = 0;
+    e->exp_max_len = 0;
+    e->values = new_hash_table(0);
+
+    if(expression == NULL)
+    {
+        expression = e;
+    } else
+    {
+        last = expression;
+        while(last->next != NULL) last = last->next;
+        last->next = e;
+    }
+    return e;
+}
+
+/* add a value or values from file to expression */
+static void
+add_expression_value(struct expression *e,char *value)
+{
+    char *value_file;
+
+    if(strstr(value,"file:") == value)
+    {
+        value_file = expand_home(&value[5]);
+        read_expression_file(e,value_file);
+        free(value_file);
+    } else
+    {
+        e->value_count += hash_table_add(e->values,value,strlen(value),NULL);
+    }
+}
+
+void
+add_expression(char *optarg)
+{
+    char *op_pos;
+    char op;
+    struct expression *e;
+
+    op = find_expression_op(optarg,&op_pos);
 
     *op_pos = 0;
 
     e = expression;
 
-    if(e == NULL)
+    while(e != NULL && (e->tree || e->op != op || strcasecmp(optarg,e->field) != 0)) e = e->next;
+
+    if(e == NULL) e = new_expression(optarg,op,0);
+
+    add_expression_value(e,op_pos + 1);
+}
+
+/* boolean expression parsing */
+static char *tree_pos;       /* current parsing position */
+static char *tree_text;      /* the whole expression for error messages */
+
+static struct expr_node *parse_tree_or();
+
+static struct expr_node *
+new_expr_node(char type)
+{
+    struct expr_node *n = xmalloc(sizeof(struct expr_node));
+
+    n->type = type;
+    n->e = NULL;
+    n->children = 0;
+    n->child = NULL;
+    n->cost = 0;
+    n->evals = 0;
+    n->hits = 0;
+    n->since_reorder = 0;
+    return n;
+}
+
+/* add child to and/or node, nodes of same type are merged */
+static void
+add_expr_child(struct expr_node *n,struct expr_node *c)
+{
+    int i;
+
+    if(c->type == n->type && n->type != EN_NOT)
     {
-        expression = xmalloc(sizeof(struct expression));
-        expression->next =  NULL;
-        e = expression;
-        e->field = xstrdup(optarg);
-        e->exp_min_len = 0;
-        e->exp_max_len = 0;
-        e->fast_entries = 0;
-        init_expr_hash(e->expr_hash); 
+        for(i = 0;i < c->children;i++) add_expr_child(n,c->child[i]);
+        free(c->child);
+        free(c);
+        return;
+    }
+    n->child = xrealloc(n->child,(n->children + 1) * sizeof(struct expr_node *));
+    n->child[n->children++] = c;
+}
+
+static void
+skip_tree_space()
+{
+    while(isspace(*tree_pos)) tree_pos++;
+}
+
+/* check if keyword is at the current position, skip it if found */
+static int
+tree_keyword(char *keyword)
+{
+    size_t len = strlen(keyword);
+
+    if(strncasecmp(tree_pos,keyword,len) == 0 &&
+       (isspace(tree_pos[len]) || tree_pos[len] == '(' || tree_pos[len] == ')' || !tree_pos[len]))
+    {
+        tree_pos += len;
+        skip_tree_space();
+        return 1;
+    }
+    return 0;
+}
+
+/* predicate: field op value, value can be quoted using double quotes */
+static struct expr_node *
+parse_tree_predicate()
+{
+    struct expr_node *n;
+    char *field,*value,*w;
+    char op;
+
+    if(!*tree_pos || *tree_pos == ')') panic("Incomplete expression, comparison expected",tree_text,NULL);
+
+    field = tree_pos;
+    while(*tree_pos && !strchr("=^~!?()",*tree_pos) && !isspace(*tree_pos)) tree_pos++;
+
+    op = *tree_pos;
+    if(tree_pos == field || !op || !strchr("=^~!?",op)) panic("Expression must contain an operator: =,^,~,? or !",tree_text,NULL);
+#ifndef HAVE_REGEX
+    if(op == OP_REQEXP) panic("Regular expressions are not supported in this system",tree_text,NULL);
+#endif
+    *tree_pos++ = 0;
+
+    value = xmalloc(strlen(tree_pos) + 1);
+    w = value;
+
+    if(*tree_pos == '"')
+    {
+        tree_pos++;
+        while(*tree_pos && *tree_pos != '"')
+        {
+            if(*tree_pos == '\\' && (tree_pos[1] == '"' || tree_pos[1] == '\\')) tree_pos++;
+            *w++ = *tree_pos++;
+        }
+        if(*tree_pos != '"') panic("Quotation not ended in expression",tree_text,NULL);
+        tree_pos++;
     } else
     {
-        do
+        while(*tree_pos && *tree_pos != ')' && !isspace(*tree_pos)) *w++ = *tree_pos++;
+    }
+    *w = 0;
+    skip_tree_space();
+
+    n = new_expr_node(EN_LEAF);
+    n->e = new_expression(field,op,1);
+    add_expression_value(n->e,value);
+    free(value);
+    return n;
+}
+
+/* factor: not factor | ( or-expression ) | predicate */
+static struct expr_node *
+parse_tree_not()
+{
+    struct expr_node *n;
+
+    if(tree_keyword("not"))
+    {
+        n = new_expr_node(EN_NOT);
+        add_expr_child(n,parse_tree_not());
+        return n;
+    }
+
+    if(*tree_pos == '(')
+    {
+        tree_pos++;
+        skip_tree_space();
+        n = parse_tree_or();
+        if(*tree_pos != ')') panic("Missing ) in expression",tree_text,NULL);
+        tree_pos++;
+        skip_tree_space();
+        return n;
+    }
+
+    return parse_tree_predicate();
+}
+
+/* term: factor and factor ... */
+static struct expr_node *
+parse_tree_and()
+{
+    struct expr_node *n,*first;
+
+    first = parse_tree_not();
+    if(!tree_keyword("and")) return first;
+
+    n = new_expr_node(EN_AND);
+    add_expr_child(n,first);
+    do
+    {
+        add_expr_child(n,parse_tree_not());
+    } while(tree_keyword("and"));
+    return n;
+}
+
+/* expression: term or term ... */
+static struct expr_node *
+parse_tree_or()
+{
+    struct expr_node *n,*first;
+
+    first = parse_tree_and();
+    if(!tree_keyword("or")) return first;
+
+    n = new_expr_node(EN_OR);
+    add_expr_child(n,first);
+    do
+    {
+        add_expr_child(n,parse_tree_and());
+    } while(tree_keyword("or"));
+    return n;
+}
+
+/* parse a boolean expression like (a=1 or b^2) and not c~x */
+void
+add_expression_tree(char *optarg)
+{
+    char *text = xstrdup(optarg);
+
+    tree_text = optarg;
+    tree_pos = text;
+    skip_tree_space();
+    if(!*tree_pos) panic("Empty expression",NULL,NULL);
+    expression_tree = parse_tree_or();
+    if(*tree_pos) panic("Syntax error in expression",tree_pos,NULL);
+}
+
+/* estimate the cost of a predicate, the hash based comparisons are cheap,
+   contains and regular expressions must scan all values */
+#define COST_HASH 1.0
+#define COST_CONTAINS 4.0
+#define COST_REGEXP 25.0
+
+static void
+init_expression_cost(struct expr_node *n)
+{
+    int i;
+
+    switch(n->type)
+    {
+        case EN_LEAF:
+            switch(n->e->op)
+            {
+                case OP_EQUAL:
+                case OP_NOT_EQUAL:
+                    n->cost = COST_HASH;
+                    break;
+                case OP_START:
+                    n->cost = COST_HASH * (double) (n->e->exp_max_len - n->e->exp_min_len + 1);
+                    break;
+                case OP_CONTAINS:
+                    n->cost = COST_CONTAINS * (double) n->e->value_count;
+                    break;
+                case OP_REQEXP:
+                    n->cost = COST_REGEXP * (double) n->e->value_count;
+                    break;
+            }
+            break;
+        default:
+            for(i = 0;i < n->children;i++) init_expression_cost(n->child[i]);
+            order_expression_node(n);
+            break;
+    }
+}
+
+/* combine the -e expressions and the boolean expression to a single tree */
+static void
+init_expression_tree(int and)
+{
+    struct expression *e = expression;
+    struct expr_node *n,*plain = NULL,*root;
+
+    while(e != NULL)
+    {
+        if(!e->tree)
         {
-            if(strcasecmp(optarg,e->field) == 0 && e->op == op) 
+            n = new_expr_node(EN_LEAF);
+            n->e = e;
+            if(plain == NULL)
             {
-                found = 1;
+                plain = n;
             } else
             {
-                last = e;
-                e = e->next;
+                if(plain->type == EN_LEAF)
+                {
+                    root = new_expr_node(and ? EN_AND : EN_OR);
+                    add_expr_child(root,plain);
+                    plain = root;
+                }
+                add_expr_child(plain,n);
             }
         }
-        while(e != NULL && !found);
+        e = e->next;
+    }
 
-        if(!found)
+    if(plain != NULL)
+    {
+        if(expression_tree != NULL)
+        {
+            root = new_expr_node(EN_AND);
+            add_expr_child(root,expression_tree);
+            add_expr_child(root,plain);
+            expression_tree = root;
+        } else
         {
-            last->next = xmalloc(sizeof(struct expression));
-            e = last->next;
-            e->next = NULL;
-            e->field = xstrdup(optarg);
-            e->exp_min_len = 0;
-            e->exp_max_len = 0;
-            e->fast_entries = 0;
-            init_expr_hash(e->expr_hash);
+            expression_tree = plain;
         }
     }
 
-    op_pos++;
-    if(strstr(op_pos,"file:") == op_pos)
-    {
-        value_file = expand_home(&op_pos[5]);
-        read_expression_file(e->expr_hash,value_file);
-        free(value_file);
-    } else
-    {
-        add_expression_to_list(e->expr_hash,op_pos);
-    }
-    e->found = 0;
-    e->op = op;
+    if(expression_tree != NULL) init_expression_cost(expression_tree);
 }
-
 static void
-init_expression()
+init_expression(int casecmp)
 {
     struct expression *e = expression;
-    register struct expr_list *l;
-    register int i;
-    int rc,min_init;
+    register uint8_t *v;
+    register size_t i,len;
+#ifdef HAVE_REGEX
+    int rc;
     size_t buflen;
     char *errbuf;
+#endif
 
     while(e != NULL)
     {
+        if(casecmp) hash_table_casefold(e->values);
+#ifdef HAVE_REGEX
+        if(e->op == OP_REQEXP) e->reg = xmalloc((e->value_count + 1) * sizeof(regex_t));
+#endif
         i = 0;
-        min_init = 0;
-        while(i < MAX_EXPR_HASH)
+        v = hash_table_next(e->values,NULL);
+        while(v != NULL)
         {
-            l = e->expr_hash[i];
-
-	        if (l != NULL && e->fast_entries <= MAX_EXPR_FAST_LIST) e->fast_expr_hash[e->fast_entries++] = i; 
-
-	        while(l != NULL)
-            {
-                if(!min_init) {min_init = 1;e->exp_min_len = l->value_len;}
-                if(l->value_len < e->exp_min_len) e->exp_min_len = l->value_len;
-                if(l->value_len > e->exp_max_len) e->exp_max_len = l->value_len;
+            len = hash_table_key_len(v);
+            if(!i || len < e->exp_min_len) e->exp_min_len = len;
+            if(len > e->exp_max_len) e->exp_max_len = len;
 
 #ifdef HAVE_REGEX
-		        if(e->op == OP_REQEXP)
+            if(e->op == OP_REQEXP)
+            {
+                rc = regcomp(&e->reg[i],v,REG_EXTENDED | REG_NOSUB);
+                if(rc)
                 {
-                    rc = regcomp(&l->reg,l->value,REG_EXTENDED | REG_NOSUB);
-                    if(rc)
-                    {
-                        buflen = regerror(rc,&l->reg,NULL,0);
-                        errbuf = xmalloc(buflen + 1);
-                        regerror(rc,&l->reg,errbuf,buflen);
-                        panic("Error in regular expression",l->value,errbuf);
-                    }
+                    buflen = regerror(rc,&e->reg[i],NULL,0);
+                    errbuf = xmalloc(buflen + 1);
+                    regerror(rc,&e->reg[i],errbuf,buflen);
+                    panic("Error in regular expression",v,errbuf);
                 }
-#endif
-                l = l->next;
             }
+#endif
             i++;
+            v = hash_table_next(e->values,v);
         }
-        if(e->fast_entries > MAX_EXPR_FAST_LIST) e->fast_entries = 0; 
         e = e->next;
     }
 }
 
+/* value sets and lookup tables having at least this many keys get a Bloom filter */
+#define BLOOM_MIN_KEYS 65536
+
+/* add Bloom filters for large expression value sets and lookup tables */
+static void
+init_bloom(int persistent)
+{
+    struct expression *e = expression;
+    struct lookup *l = lookup;
+
+    while(e != NULL)
+    {
+        if((e->op == OP_EQUAL || e->op == OP_NOT_EQUAL || e->op == OP_START) && e->values->count >= BLOOM_MIN_KEYS)
+            hash_table_bloom(e->values,persistent);
+        e = e->next;
+    }
+
+    while(l != NULL)
+    {
+        if(l->data->count >= BLOOM_MIN_KEYS) hash_table_bloom(l->data,persistent);
+        l = l->next;
+    }
+}
+
 /* if variable is set it will not be overwritten */
 void
 set_env(char *name, char *value)
@@ -980,6 +1317,9 @@ main(int argc, char **argv)
     int expression_and = 0;
     int expression_invert = 0;
     int expression_casecmp = 0;
+    int bloom_files = 0;
+    int build_index = 0;
+    int compile = 0;
     struct structure *s = NULL;
     char *structure_to_use = NULL;
     char *output_to_use = NULL;
@@ -987,6 +1327,7 @@ main(int argc, char **argv)
     char *ofile_to_use = NULL;
     char *anon_to_use = NULL;
     char *field_list = NULL;
+    int jobs = 1;
 
 #ifdef HAVE_SIGACTION
 #ifndef SA_NOCLDWAIT
@@ -1055,6 +1396,15 @@ main(int argc, char **argv)
                 case 'e':
                     add_expression(optarg);
                     break;
+                case 'E':
+                    if(expression_tree == NULL)
+                    {
+                        add_expression_tree(optarg);
+                    } else
+                    {
+                        panic("Only one -E option allowed",NULL,NULL);
+                    }
+                    break;
                 case 'r':
                     add_replace(optarg);
                     break;
@@ -1064,6 +1414,15 @@ main(int argc, char **argv)
                 case 'X':
                     expression_casecmp = 1;
                     break;
+                case 'B':
+                    bloom_files = 1;
+                    break;
+                case 'L':
+                    build_index = 1;
+                    break;
+                case 'C':
+                    compile = 1;
+                    break;
                 case 'd':
                     debug = 1;
                     break;
@@ -1093,6 +1452,10 @@ main(int argc, char **argv)
                         panic("Only one -A option allowed",NULL,NULL);
                     }
                     break;
+                case 'j':
+                    jobs = atoi(optarg);
+                    if(jobs < 1) panic("Invalid number of jobs",optarg,NULL);
+                    break;
                 default:
                     usage(opt);
                     exit(EXIT_FAILURE);
@@ -1118,8 +1481,15 @@ main(int argc, char **argv)
     parserc(config_to_use,field_list);
 
     check_rc(output_to_use);
+
+    if(init_lookups(build_index) == 0 && build_index) panic("No lookups having an index file",NULL,NULL);
+    if(build_index) exit(EXIT_SUCCESS);
      
-    init_expression();
+    init_expression(expression_casecmp);
+
+    init_expression_tree(expression_and);
+
+    init_bloom(bloom_files);
 
     if(info)
     {
@@ -1127,6 +1497,16 @@ main(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
     
+    if(compile)
+    {
+        if(structure_to_use == NULL) panic("Structure must be given with -s option when compiling",NULL,NULL);
+        if(anon_to_use != NULL || debug) panic("Options -A and -d cannot be used with --compile",NULL,NULL);
+        s = find_structure(structure_to_use);
+        if(s == NULL) panic("No structure named as",structure_to_use,NULL);
+        compile_structure(s,strict,ofile_to_use);
+        exit(EXIT_SUCCESS);
+    }
+
     ffe_open = getenv("FFEOPEN");
 
     if(structure_to_use == NULL)
@@ -1156,7 +1536,7 @@ main(int argc, char **argv)
 
     set_output_file(ofile_to_use);
 
-    execute(s,strict,expression_and,expression_invert,expression_casecmp,debug,anon_to_use);
+    execute(s,strict,expression_invert,expression_casecmp,debug,anon_to_use,jobs);
 
     close_output_file();
 
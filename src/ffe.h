@@ -51,6 +51,12 @@
 #include <unistd.h>
 #endif 
 
+#if defined(HAVE_ICONV_H) && defined(HAVE_ICONV)
+#include <iconv.h>
+#else
+#undef HAVE_ICONV
+#endif
+
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
@@ -94,6 +100,16 @@
 #define strcasestr strstr
 #endif
 
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define BSWAP16(x) __builtin_bswap16(x)
+#define BSWAP32(x) __builtin_bswap32(x)
+#define BSWAP64(x) __builtin_bswap64(x)
+#else
+#define BSWAP16(x) ((uint16_t) (((x) >> 8) | ((x) << 8)))
+#define BSWAP32(x) ((uint32_t) (((x) >> 24) | (((x) >> 8) & 0xff00) | (((x) << 8) & 0xff0000) | ((x) << 24)))
+#define BSWAP64(x) ((uint64_t) BSWAP32((uint32_t) ((x) >> 32)) | ((uint64_t) BSWAP32((uint32_t) (x)) << 32))
+#endif
+
 /* Types */
 
 #define DEFAULT_OUTPUT "default"
@@ -102,6 +118,7 @@
 
 #define EXACT 1
 #define LONGEST 2
+#define RANGE 3
 
 /* contains field names from include-option or from -f paramter */
 struct include_field {
@@ -137,25 +154,171 @@ struct output {
     struct output *next;
 };
 
-#define MAX_EXPR_HASH 32771
+/* hash table slot, entry is the arena offset + 1, 0 for empty slot */
+struct hash_slot {
+    uint64_t hash;
+    uint64_t entry;
+};
+
+/* open addressing hash table, keys and values are stored in arena */
+struct hash_table {
+    size_t size;      /* slot count, power of two */
+    size_t count;
+    int values;       /* does table contain values for keys */
+    int casefold;     /* keys are case insensitive */
+    struct hash_slot *slots;
+    uint8_t *arena;
+    size_t arena_size;
+    size_t arena_used;
+    uint64_t *bloom;     /* blocked Bloom filter in front of slots, NULL if not used */
+    size_t bloom_blocks;
+    char *source;        /* file containing all the keys, used for saving the filter */
+    size_t source_count;
+};
+
+/* filter protocols */
+#define PIPE_ONCE 0       /* command is started for every value */
+#define PIPE_LINES 1      /* persistent command, one value per line */
+#define PIPE_LENGTH 2     /* persistent command, values are preceded by length line */
+#define PIPE_BUILTIN 3    /* built-in transformation functions, no command */
+#define PIPE_BATCH 4      /* command is started once for values of several records */
+
+/* records read ahead for a persistent filter when batch size is not given */
+#define PERSISTENT_BATCH 1024
+
+/* built-in transformation functions */
+#define T_UNKNOWN 0
+#define T_UPPER 1
+#define T_LOWER 2
+#define T_SUBSTR 3
+#define T_PAD 4
+#define T_REPLACE 5
+#define T_SCALE 6
+#define T_DATE 7
+#define T_CHARSET 8
+
+struct transform {
+    int function;
+    int start;            /* substr start */
+    int length;           /* substr and pad length */
+    uint8_t pad_char;
+    int pad_left;
+    double factor;        /* scale */
+    int decimals;         /* scale, -1 = as short as possible */
+    char *arg[2];         /* replacement, date formats */
+#if HAVE_REGEX
+    regex_t reg;
+#endif
+#ifdef HAVE_ICONV
+    iconv_t cd;
+#endif
+    struct transform *next;
+};
 
 struct pipe {
     char *name;
     char *command;
+    int mode;
+    struct transform *t;  /* functions for built-in transformations */
+    struct value_cache *cache; /* earlier outputs, NULL if not cached */
+    int batch;            /* max records in one batch */
+    struct hash_table *batch_values;  /* values waiting for the next batch */
+    struct hash_table *batch_results; /* outputs of the last batch */
+    int wfd;              /* pipes to persistent command, -1 if not started */
+    int rfd;
+    pid_t pid;
+    int timeout;          /* seconds to wait for a reply of persistent command, 0 waits forever */
+    uint8_t *wbuf;        /* values not yet written to wfd */
+    size_t wsize;
+    size_t wlen;
+    uint8_t *rbuf;        /* replies read from rfd, not yet consumed */
+    size_t rsize;
+    size_t rpos;
+    size_t rlen;
     struct pipe *next;
 };
 
-struct lookup_data {
-    uint8_t *key;
+/* largest number of entries in one value cache */
+#define MAX_CACHE_ENTRIES (1 << 24)
+
+/* estimated memory used by one cache entry of anonymized values, used to size the entry table */
+#define ANON_CACHE_ENTRY_SIZE 96
+
+/* direct mapped cache for results computed from field values */
+struct cache_entry {
+    uint64_t hash;
+    uint8_t *data;       /* key, 0, value, 0 */
+    size_t data_size;
+    size_t key_len;
+    size_t value_len;
+};
+
+struct value_cache {
+    size_t size;         /* entry count, power of two */
+    struct cache_entry *entries;
+    unsigned long hits;
+    unsigned long misses;
+    struct cache_entry *probe;   /* entry for last unsuccessful search */
+    uint64_t probe_hash;
+    size_t memory;       /* bytes used by the entries and their data */
+    size_t memory_limit; /* 0 if only the entry count limits the cache */
+};
+
+/* compressed radix tree for longest match lookups,
+   children are sorted by the first byte of the label */
+struct radix_node {
+    uint8_t *label;
+    size_t label_len;
+    uint8_t *value;
+    int children;
+    struct radix_node **child;
+};
+
+/* one interval of range lookup, rows are sorted by low */
+struct range {
+    uint8_t *low;
+    uint8_t *high;
+    uint8_t *value;
+    double nlow;          /* numeric bounds, if table is numeric */
+    double nhigh;
+    double max_high;      /* largest nhigh of this and preceding rows */
+    uint8_t *max_shigh;   /* same for string bounds */
+    size_t order;         /* row number in file */
+};
+
+/* range compare types */
+#define RANGE_NUMBER 'n'
+#define RANGE_IP 'i'
+#define RANGE_STRING 's'
+
+struct range_table {
+    size_t count;
+    size_t size;
+    char compare;
+    struct range *r;
+};
+
+struct lookup_file {
+    char *name;             /* NULL for a pair given after a file */
+    char separator;
+    uint8_t *key;           /* pair, kept in rc order so the first definition wins */
     uint8_t *value;
-    struct lookup_data *next;
+    struct lookup_file *next;
 };
 
 struct lookup {
     char *name;
     char type; 
     uint8_t *default_value;
-    struct lookup_data *data[MAX_EXPR_HASH];
+    struct hash_table *data;     /* pairs and contents of files */
+    struct lookup_file *files;
+    char *index_file;
+    struct hash_table *index;    /* mapped index file, NULL if not used */
+    struct radix_node *radix;    /* keys of data for longest match */
+    struct range_table *ranges;  /* intervals for range lookup */
+    size_t cache_size;           /* size of per field result caches, 0 if not used */
+    char *key_fields;            /* comma separated list of fields making the search key, NULL if key is the field itself */
+    char key_separator;          /* separator between key fields */
     struct lookup *next;
 };
 
@@ -167,22 +330,13 @@ struct replace {
     struct replace *next;
 };
 
-/* expression values */
-struct expr_list {
-    char *value;
-    int value_len;
-#if HAVE_REGEX
-    regex_t reg;
-#endif
-    struct expr_list *next;
-};
-
 /* anonymization methods */
 #define A_MASK 0
 #define A_RANDOM 1
 #define A_NRANDOM 2
 #define A_HASH 3
 #define A_NHASH 4
+#define A_TOKEN 5
 #define A_UNKNOWN 999
 
 struct anon_field {
@@ -193,31 +347,74 @@ struct anon_field {
    int length;
    int key_length;
    uint8_t *key;
+   int secret_length;
+   uint8_t *secret;  /* key for keyed hashes, NULL if not given */
+   int siphash;      /* use SipHash instead of libgcrypt digests */
+   uint64_t sipkey[2];
+   void *md;         /* libgcrypt digest handle, reused for every field */
+   struct value_cache *cache; /* anonymized values of HASH and NHASH, NULL if not cached */
+   int seed_length;
+   uint8_t *seed;    /* seed for RANDOM and NRANDOM, NULL if system random source is used */
+   char *vault_file; /* token vault for TOKEN */
+   struct token_vault *vault;
    struct anon_field *next;
 };
 
 
-#define MAX_EXPR_FAST_LIST 61
-
 /* search expression */
 struct expression {
     char *field;
     char op;
     int found;
+    int tree;         /* expression is a leaf of the boolean expression tree */
+    size_t value_count;
     struct field *f;  /* pointer to field used in expression */
     size_t exp_min_len;
     size_t exp_max_len;
-    size_t fast_entries;
-    size_t fast_expr_hash[MAX_EXPR_FAST_LIST + 1];  /* fast access list for cases there is low number of values in hash list */
-    struct expr_list *expr_hash[MAX_EXPR_HASH]; /* value list*/
+    struct hash_table *values;
+#if HAVE_REGEX
+    regex_t *reg;     /* compiled values in order of addition */
+#endif
     struct expression *next;
 };
 
+/* boolean expression tree node types */
+#define EN_LEAF 'l'
+#define EN_AND 'a'
+#define EN_OR 'o'
+#define EN_NOT 'n'
+
+/* compiled boolean expression, children of and/or nodes are reordered
+   during execution according to their cost and hit rate */
+struct expr_node {
+    char type;
+    struct expression *e;          /* predicate for leaf nodes */
+    int children;
+    struct expr_node **child;
+    double cost;                   /* estimated evaluation cost */
+    unsigned long evals;           /* evaluation statistics */
+    unsigned long hits;
+    unsigned long since_reorder;
+};
+
+
+/* conversions having own formatters, others use snprintf */
+#define FMT_GENERIC 0
+#define FMT_INT 1          /* %d, %i */
+#define FMT_HEX 2          /* %x, %X */
+#define FMT_FLOAT 3        /* %f */
+#define FMT_STRING 4       /* %s */
 
 struct format
 {
     char *conversion;      /* printf conversion spec */
     int type;              /* data type for conversion, argtypes from parse_printf_format */
+    int fast;              /* FMT_ value */
+    int left;              /* - flag */
+    int zero;              /* 0 flag */
+    int width;
+    int precision;         /* -1 if not given */
+    char conv;             /* conversion character */
 };
 
 
@@ -232,8 +429,12 @@ struct field {
     int length;
     int print;
     int var_length;	/* is this field variable length */
+    int decoder;    /* DEC_ value for binary integers */
     char *lookup_table_name;
     struct lookup *lookup;
+    struct value_cache *lookup_cache; /* cached lookup results, NULL if not used */
+    struct field **key;          /* fields making the lookup key */
+    int key_count;
     struct replace *rep;  /* non NULL if value should be replaced */
     char *output_name;
     struct output *o;
@@ -245,9 +446,12 @@ struct field {
 };
 
 
-/* contains pointer to fields which will be printed */
+/* contains pointer to fields which will be printed,
+   print fields of a record are in one array made by init_structure */
 struct print_field {
     struct field *f;
+    struct output *o;              // output of the field, field or record output
+    uint8_t *directives;           // data or lookup text of the output
     uint8_t *data;                 // data start position in output buffer;
     int justify_length;
     int empty;                  // does the field contain only "empty" chars
@@ -279,6 +483,8 @@ struct record {
     struct field *f;
     char *fields_from;
     struct print_field *pf;
+    int pf_count;
+    struct field *last_field;
     struct output *o;
     char *output_name;
     int vote;
@@ -311,6 +517,11 @@ struct structure {
     int header;
     char *output_name;
     int vote;
+    int framing;
+    int record_length;  /* length of FRAME_FIXED records */
+    char *code_page_name;
+    uint8_t *decode;    /* input code page to ISO-8859-1, NULL if not translated */
+    uint8_t *encode;
     struct output *o;
     struct record *r;
     struct structure *next;
@@ -344,6 +555,7 @@ struct input_file {
 #define F_BCD 9
 #define F_UINT 10
 #define F_HEX 11
+#define F_COMP3 12
 
 /* endianess */
 #define F_UNKNOWN_ENDIAN 0
@@ -351,11 +563,32 @@ struct input_file {
 #define F_LITTLE_ENDIAN 3
 #define F_SYSTEM_ENDIAN 4
 
+/* decoders of binary integer fields, bound in init_structure */
+#define DEC_NONE 0
+#define DEC_INT8 1
+#define DEC_UINT8 2
+#define DEC_INT16 3
+#define DEC_UINT16 4
+#define DEC_INT32 5
+#define DEC_UINT32 6
+#define DEC_INT64 7
+#define DEC_UINT64 8
+#define DEC_SWAP 16     /* added to the decoder if the byte order differs from the system */
+
 /* record length values */
 #define RL_STRICT 0
 #define RL_MIN 1
 #define TL_MAX 2
 
+/* record framing of structure input */
+#define FRAME_LF 0          /* records end with LF */
+#define FRAME_FIXED 1       /* fixed length records without LF */
+#define FRAME_RDW 2         /* records having a record descriptor word */
+#define FRAME_BDW 3         /* blocks of rdw records having a block descriptor word */
+
+/* longest fixed length record without LF */
+#define MAX_FRAMED_RECORD 524288
+
 /* function prototypes */
 extern void 
 panic(char *msg,char *info,char *syserror);
@@ -391,7 +624,7 @@ extern void
 close_output_file();
 
 extern void 
-execute(struct structure *,int,int,int,int,int,char *);
+execute(struct structure *,int,int,int,int,char *,int);
 
 extern char *
 expand_home(char *);
@@ -408,6 +641,12 @@ endian_and_align(uint8_t *,int,int,int);
 extern int
 check_system_endianess();
 
+extern int
+bcd_expand(uint8_t *,uint8_t *,int,int,int);
+
+extern int
+hex_expand(uint8_t *,uint8_t *,int,int,int);
+
 extern char *
 guess_binary_structure();
 
@@ -441,12 +680,102 @@ get_indent_depth(int);
 extern void
 print_indent(uint8_t *,int);
 
+extern uint64_t
+string_hash(uint8_t *,size_t,int);
+
+extern struct hash_table *
+new_hash_table(int);
+
+extern int
+hash_table_add(struct hash_table *,uint8_t *,size_t,uint8_t *);
+
+extern uint8_t *
+hash_table_find(struct hash_table *,uint8_t *,size_t);
+
+extern void
+hash_table_clear(struct hash_table *);
+
+extern void
+hash_table_casefold(struct hash_table *);
+
+extern uint8_t *
+hash_table_next(struct hash_table *,uint8_t *);
+
 extern size_t
-hash(char *,size_t);
+hash_table_key_len(uint8_t *);
+
+extern int
+hash_table_check(struct hash_table *);
+
+extern void
+hash_table_source(struct hash_table *,char *,size_t);
+
+extern void
+hash_table_bloom(struct hash_table *,int);
 
 extern void
 anonymize_fields(char *,uint8_t,struct record *,int,uint8_t *);
 
+extern void
+print_anon_cache_stats();
+
+extern void
+anon_random_stream(int);
+
+extern void
+order_expression_node(struct expr_node *);
+
+extern int
+init_lookups(int);
+
+extern struct value_cache *
+new_value_cache(size_t);
+
+extern struct value_cache *
+new_value_cache_memory(size_t);
+
+extern uint8_t *
+value_cache_find(struct value_cache *,uint8_t *,size_t,size_t *);
+
+extern uint8_t *
+value_cache_store(struct value_cache *,uint8_t *,size_t,uint8_t *,size_t);
+
+extern uint8_t *
+radix_lookup(struct radix_node *,uint8_t *,size_t,size_t *);
+
+extern uint8_t *
+range_lookup(struct range_table *,uint8_t *);
+
+extern int
+init_prefilter(struct structure *);
+
+extern int
+prefilter_line(uint8_t *,int);
+
+extern int
+execute_transform(uint8_t *,int,struct transform *,uint8_t **);
+
+extern struct token_vault *
+open_token_vault(char *);
+
+extern void
+vault_token(struct token_vault *,uint8_t *,int,uint8_t *,int,void (*)(uint8_t *,int,void *),void *);
+
+extern uint8_t *
+code_page_table(char *);
+
+extern uint8_t *
+code_page_encoder(uint8_t *);
+
+extern void
+translate(uint8_t *,uint8_t *,int);
+
+extern void
+init_structure(struct structure *,struct record *,int,uint8_t *);
+
+extern void
+compile_structure(struct structure *,int,char *);
+
 
 
 
@@ -454,6 +783,7 @@ anonymize_fields(char *,uint8_t,struct record *,int,uint8_t *);
 extern struct structure *structure;
 extern struct output *output;
 extern struct expression *expression;
+extern struct expr_node *expression_tree;
 extern struct lookup *lookup;
 extern struct output *no_output;
 extern struct output *raw;
@@ -463,4 +793,6 @@ extern int max_binary_record_length;
 extern char *ffe_open;
 extern struct pipe *pipes;
 extern struct anon_field *anonymize;
+extern uint8_t *input_decode;
+extern uint8_t *input_encode;
 
@@ -0,0 +1,509 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Open addressing hash table for expression values and lookup tables.
+ * Keys and values are stored one after another in a single arena:
+ * key length (4 bytes), key, 0, value, 0
+ * The slot table contains the full hash and the arena offset of the entry.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+#define HASH_M 0xc6a4a7935bd1e995ULL
+#define HASH_R 47
+
+#define INITIAL_SLOTS 16
+#define INITIAL_ARENA 1024
+
+/* Bloom filter blocks are 512 bits, one cache line */
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_KEY 16
+#define BLOOM_PROBES 8
+#define BLOOM_MAGIC "ffebloom3"
+
+/* MurmurHash64A, if casefold is set the key is hashed as lowercase */
+uint64_t
+string_hash(uint8_t *key,size_t len,int casefold)
+{
+    register uint64_t h = HASH_SEED ^ (len * HASH_M);
+    uint64_t k;
+    uint8_t *end = key + (len & ~(size_t) 7);
+    int i;
+
+    while(key < end)
+    {
+        if(casefold)
+        {
+            k = 0;
+            for(i = 7;i >= 0;i--) k = (k << 8) | (uint64_t) tolower(key[i]);
+        } else
+        {
+            memcpy(&k,key,8);
+        }
+        k *= HASH_M;
+        k ^= k >> HASH_R;
+        k *= HASH_M;
+        h ^= k;
+        h *= HASH_M;
+        key += 8;
+    }
+
+    switch(len & 7)
+    {
+        case 7: h ^= (uint64_t) (casefold ? tolower(key[6]) : key[6]) << 48;
+        case 6: h ^= (uint64_t) (casefold ? tolower(key[5]) : key[5]) << 40;
+        case 5: h ^= (uint64_t) (casefold ? tolower(key[4]) : key[4]) << 32;
+        case 4: h ^= (uint64_t) (casefold ? tolower(key[3]) : key[3]) << 24;
+        case 3: h ^= (uint64_t) (casefold ? tolower(key[2]) : key[2]) << 16;
+        case 2: h ^= (uint64_t) (casefold ? tolower(key[1]) : key[1]) << 8;
+        case 1: h ^= (uint64_t) (casefold ? tolower(key[0]) : key[0]);
+                h *= HASH_M;
+    }
+
+    h ^= h >> HASH_R;
+    h *= HASH_M;
+    h ^= h >> HASH_R;
+    return h;
+}
+
+struct hash_table *
+new_hash_table(int values)
+{
+    struct hash_table *t = xmalloc(sizeof(struct hash_table));
+
+    t->size = INITIAL_SLOTS;
+    t->count = 0;
+    t->values = values;
+    t->casefold = 0;
+    t->slots = xmalloc(t->size * sizeof(struct hash_slot));
+    memset(t->slots,0,t->size * sizeof(struct hash_slot));
+    t->arena_size = INITIAL_ARENA;
+    t->arena_used = 0;
+    t->arena = xmalloc(t->arena_size);
+    t->bloom = NULL;
+    t->bloom_blocks = 0;
+    t->source = NULL;
+    t->source_count = 0;
+    return t;
+}
+
+static inline uint32_t
+entry_key_len(uint8_t *entry)
+{
+    uint32_t len;
+
+    memcpy(&len,entry,sizeof(uint32_t));
+    return len;
+}
+
+static int
+key_equal(struct hash_table *t,uint8_t *entry,uint8_t *key,size_t len)
+{
+    if(entry_key_len(entry) != len) return 0;
+    entry += sizeof(uint32_t);
+    if(t->casefold)
+    {
+        while(len--)
+        {
+            if(tolower(*entry) != tolower(*key)) return 0;
+            entry++;
+            key++;
+        }
+        return 1;
+    }
+    return memcmp(entry,key,len) == 0;
+}
+
+/* find the slot for key, returns empty slot if key is not found */
+static struct hash_slot *
+find_slot(struct hash_table *t,uint64_t h,uint8_t *key,size_t len)
+{
+    register size_t mask = t->size - 1;
+    register size_t i = (size_t) h & mask;
+    register struct hash_slot *s;
+
+    while(1)
+    {
+        s = &t->slots[i];
+        if(!s->entry) return s;
+        if(s->hash == h && key_equal(t,&t->arena[s->entry - 1],key,len)) return s;
+        i = (i + 1) & mask;
+    }
+}
+
+/* make slot table again, e.g. after size or casefolding has been changed */
+static void
+rehash(struct hash_table *t,size_t size)
+{
+    struct hash_slot *old = t->slots;
+    size_t old_size = t->size;
+    register size_t i,j;
+    uint8_t *entry;
+
+    t->size = size;
+    t->slots = xmalloc(size * sizeof(struct hash_slot));
+    memset(t->slots,0,size * sizeof(struct hash_slot));
+
+    for(i = 0;i < old_size;i++)
+    {
+        if(old[i].entry)
+        {
+            entry = &t->arena[old[i].entry - 1];
+            if(t->casefold) old[i].hash = string_hash(entry + sizeof(uint32_t),entry_key_len(entry),1);
+            j = (size_t) old[i].hash & (size - 1);
+            while(t->slots[j].entry) j = (j + 1) & (size - 1);
+            t->slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+/* bits for hash in a Bloom filter block, block is selected using the high bits of hash */
+static inline uint64_t *
+bloom_block(struct hash_table *t,uint64_t h)
+{
+    return &t->bloom[((size_t) (h >> 32) & (t->bloom_blocks - 1)) * BLOOM_BLOCK_WORDS];
+}
+
+static inline void
+bloom_set(struct hash_table *t,uint64_t h)
+{
+    register uint64_t *b = bloom_block(t,h);
+    register uint64_t h2 = h * HASH_M;
+    register unsigned int bit = (unsigned int) h2 & 511;
+    register unsigned int step = (unsigned int) (h2 >> 9) | 1;
+    register int i;
+
+    for(i = 0;i < BLOOM_PROBES;i++)
+    {
+        b[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+        bit = (bit + step) & 511;
+    }
+}
+
+static inline int
+bloom_test(struct hash_table *t,uint64_t h)
+{
+    register uint64_t *b = bloom_block(t,h);
+    register uint64_t h2 = h * HASH_M;
+    register unsigned int bit = (unsigned int) h2 & 511;
+    register unsigned int step = (unsigned int) (h2 >> 9) | 1;
+    register int i;
+
+    for(i = 0;i < BLOOM_PROBES;i++)
+    {
+        if(!(b[bit >> 6] & ((uint64_t) 1 << (bit & 63)))) return 0;
+        bit = (bit + step) & 511;
+    }
+    return 1;
+}
+
+/* add key and value to table, existing key is not replaced
+   returns 1 if key was added
+ */
+int
+hash_table_add(struct hash_table *t,uint8_t *key,size_t len,uint8_t *value)
+{
+    uint64_t h = string_hash(key,len,t->casefold);
+    struct hash_slot *s;
+    size_t value_len = 0,need;
+    uint32_t len32 = (uint32_t) len;
+    uint8_t *w;
+
+    s = find_slot(t,h,key,len);
+    if(s->entry) return 0;
+
+    if(t->values && value != NULL) value_len = strlen((char *) value);
+    need = sizeof(uint32_t) + len + 1 + (t->values ? value_len + 1 : 0);
+
+    if(t->arena_used + need > t->arena_size)
+    {
+        while(t->arena_used + need > t->arena_size) t->arena_size *= 2;
+        t->arena = xrealloc(t->arena,t->arena_size);
+    }
+
+    w = &t->arena[t->arena_used];
+    memcpy(w,&len32,sizeof(uint32_t));
+    w += sizeof(uint32_t);
+    memcpy(w,key,len);
+    w[len] = 0;
+    if(t->values)
+    {
+        w += len + 1;
+        if(value_len) memcpy(w,value,value_len);
+        w[value_len] = 0;
+    }
+
+    s->hash = h;
+    s->entry = t->arena_used + 1;
+    if(t->bloom != NULL) bloom_set(t,h);
+    t->arena_used += need;
+    t->count++;
+
+    if(t->count * 10 > t->size * 7) rehash(t,t->size * 2);
+    return 1;
+}
+
+/* returns the value for key or key itself if the table has no values, NULL if not found */
+uint8_t *
+hash_table_find(struct hash_table *t,uint8_t *key,size_t len)
+{
+    struct hash_slot *s;
+    uint8_t *entry;
+    uint64_t h;
+
+    if(!t->count) return NULL;
+
+    h = string_hash(key,len,t->casefold);
+    if(t->bloom != NULL && !bloom_test(t,h)) return NULL;
+
+    s = find_slot(t,h,key,len);
+    if(!s->entry) return NULL;
+
+    entry = &t->arena[s->entry - 1];
+    return entry + sizeof(uint32_t) + (t->values ? entry_key_len(entry) + 1 : 0);
+}
+
+/* remove all keys, memory is kept for reuse */
+void
+hash_table_clear(struct hash_table *t)
+{
+    memset(t->slots,0,t->size * sizeof(struct hash_slot));
+    t->count = 0;
+    t->arena_used = 0;
+}
+
+/* make keys case insensitive */
+void
+hash_table_casefold(struct hash_table *t)
+{
+    if(t->casefold) return;
+    t->casefold = 1;
+    rehash(t,t->size);
+    if(t->bloom != NULL)
+    {
+        free(t->bloom);
+        t->bloom = NULL;
+        t->bloom_blocks = 0;
+    }
+}
+
+/* iterate keys in order of addition, NULL gives the first key */
+uint8_t *
+hash_table_next(struct hash_table *t,uint8_t *key)
+{
+    uint8_t *entry;
+    size_t offset;
+
+    if(key == NULL)
+    {
+        offset = 0;
+    } else
+    {
+        entry = key - sizeof(uint32_t);
+        offset = (size_t) (key - t->arena) + entry_key_len(entry) + 1;
+        if(t->values) offset += strlen((char *) &t->arena[offset]) + 1;
+    }
+
+    if(offset >= t->arena_used) return NULL;
+    return &t->arena[offset + sizeof(uint32_t)];
+}
+
+/* key length of key returned by hash_table_next */
+size_t
+hash_table_key_len(uint8_t *key)
+{
+    return entry_key_len(key - sizeof(uint32_t));
+}
+
+/* check that all slots point to complete entries inside the arena,
+   used for tables read from files. Returns 0 if the table is not valid
+ */
+int
+hash_table_check(struct hash_table *t)
+{
+    register size_t i;
+    size_t used = 0,offset,key_len;
+    uint8_t *entry;
+
+    for(i = 0;i < t->size;i++)
+    {
+        if(!t->slots[i].entry) continue;
+        used++;
+        offset = (size_t) t->slots[i].entry - 1;
+        if(offset >= t->arena_used || t->arena_used - offset < sizeof(uint32_t) + 1) return 0;
+        entry = &t->arena[offset];
+        key_len = entry_key_len(entry);
+        offset += sizeof(uint32_t);
+        if(key_len >= t->arena_used - offset || t->arena[offset + key_len]) return 0;
+        offset += key_len + 1;
+        if(t->values && (offset >= t->arena_used || memchr(&t->arena[offset],0,t->arena_used - offset) == NULL)) return 0;
+    }
+    return used == t->count && used < t->size;
+}
+
+/* tell that keys from file have been added to table, before is the key count
+   before reading the file. Filter can be saved only if all keys are from one file
+ */
+void
+hash_table_source(struct hash_table *t,char *file,size_t before)
+{
+    if(!before && t->source == NULL && !t->source_count)
+    {
+        t->source = xstrdup(file);
+        t->source_count = t->count;
+    } else
+    {
+        if(t->source != NULL) free(t->source);
+        t->source = NULL;
+        t->source_count = (size_t) -1;
+    }
+}
+
+#ifdef HAVE_SYS_STAT_H
+/* header of the saved filter, the filter is valid if the list file has not changed.
+   The nanoseconds of mtime catch a rewrite within the same second where available
+ */
+struct bloom_header {
+    char magic[16];
+    uint64_t file_size;
+    int64_t file_mtime;
+    int64_t file_mtime_nsec;
+    uint64_t file_ino;
+    uint64_t count;
+    uint64_t blocks;
+    uint32_t casefold;
+};
+
+static void
+make_bloom_header(struct hash_table *t,struct stat *st,struct bloom_header *h)
+{
+    memset(h,0,sizeof(struct bloom_header));
+    strcpy(h->magic,BLOOM_MAGIC);
+    h->file_size = (uint64_t) st->st_size;
+    h->file_mtime = (int64_t) st->st_mtime;
+    h->count = (uint64_t) t->count;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    h->file_mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+#endif
+    h->file_ino = (uint64_t) st->st_ino;
+    h->blocks = (uint64_t) t->bloom_blocks;
+    h->casefold = (uint32_t) t->casefold;
+}
+
+/* read filter saved by earlier run, returns 1 if a valid filter was read */
+static int
+read_bloom(struct hash_table *t,char *name,struct bloom_header *expected)
+{
+    FILE *fp;
+    struct bloom_header h;
+    int ok = 0;
+
+    fp = fopen(name,"rb");
+    if(fp == NULL) return 0;
+
+    if(fread(&h,sizeof(h),1,fp) == 1 && memcmp(&h,expected,sizeof(h)) == 0)
+    {
+        ok = fread(t->bloom,BLOOM_BLOCK_WORDS * sizeof(uint64_t),t->bloom_blocks,fp) == t->bloom_blocks;
+    }
+    fclose(fp);
+    return ok;
+}
+
+static void
+write_bloom(struct hash_table *t,char *name,struct bloom_header *h)
+{
+    FILE *fp;
+
+    fp = fopen(name,"wb");
+    if(fp == NULL)
+    {
+        problem("Cannot write Bloom filter file",name,strerror(errno));
+        return;
+    }
+
+    if(fwrite(h,sizeof(struct bloom_header),1,fp) != 1 ||
+       fwrite(t->bloom,BLOOM_BLOCK_WORDS * sizeof(uint64_t),t->bloom_blocks,fp) != t->bloom_blocks)
+    {
+        problem("Error in writing Bloom filter file",name,strerror(errno));
+    }
+    if(fclose(fp)) problem("Error in writing Bloom filter file",name,strerror(errno));
+}
+#endif
+
+/* build a Bloom filter for table, filter is sized from the key count.
+   If persistent is set and all keys are read from one file, filter is read from file.bloom
+   or it will be saved there for later runs
+ */
+void
+hash_table_bloom(struct hash_table *t,int persistent)
+{
+    register size_t i;
+    size_t blocks = 1;
+#ifdef HAVE_SYS_STAT_H
+    struct stat st;
+    struct bloom_header h;
+    char *name = NULL;
+#endif
+
+    if(t->bloom != NULL) free(t->bloom);
+
+    while(blocks * BLOOM_BLOCK_WORDS * 64 < t->count * BLOOM_BITS_PER_KEY) blocks *= 2;
+    t->bloom_blocks = blocks;
+    t->bloom = xmalloc(blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+
+#ifdef HAVE_SYS_STAT_H
+    if(persistent && t->source != NULL && t->source_count == t->count && stat(t->source,&st) == 0)
+    {
+        name = xmalloc(strlen(t->source) + 7);
+        strcpy(name,t->source);
+        strcat(name,".bloom");
+        make_bloom_header(t,&st,&h);
+        if(read_bloom(t,name,&h))
+        {
+            free(name);
+            return;
+        }
+    }
+#endif
+
+    memset(t->bloom,0,blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    for(i = 0;i < t->size;i++)
+    {
+        if(t->slots[i].entry) bloom_set(t,t->slots[i].hash);
+    }
+
+#ifdef HAVE_SYS_STAT_H
+    if(name != NULL)
+    {
+        write_bloom(t,name,&h);
+        free(name);
+    }
+#endif
+}
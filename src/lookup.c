@@ -0,0 +1,651 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Loading of lookup tables from files and from precompiled index files.
+ * Index file is an image of the hash table: a header, the slot table and
+ * the key/value arena. The file is mapped to memory as such, so loading
+ * is fast and concurrent processes share the pages.
+ *
+ * Tables using longest match are also stored in a compressed radix tree,
+ * so the longest matching key is found with one walk over the search key.
+ *
+ * Range tables are sorted arrays of intervals searched with binary search.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
+
+#define INDEX_MAGIC "ffeindex1"
+#define INDEX_BYTE_ORDER 0x01020304
+
+struct index_header {
+    char magic[16];
+    uint32_t byte_order;     /* index is usable only in systems having same byte order */
+    uint32_t reserved;
+    uint64_t slots;
+    uint64_t count;
+    uint64_t slot_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t source_size;    /* total size and latest modification time of lookup files */
+    int64_t source_mtime;
+};
+
+/* read key value pairs from file */
+static void
+read_lookup_from_file(struct hash_table *data,char *file,char separator)
+{
+    FILE *fp;
+    register int line_len;
+    size_t max_line_size = 1024;
+    char *efile;
+    char *line;
+    register char *p;
+    size_t before = data->count;
+
+    efile = expand_home(file);
+
+    fp = xfopen(efile,"r");
+
+    line = xmalloc(max_line_size);
+
+    do
+    {
+#ifdef HAVE_GETLINE
+        line_len = getline(&line,&max_line_size,fp);
+#else
+        if(fgets(line,max_line_size,fp) == NULL)
+        {
+            line_len = -1;
+        } else
+        {
+            line_len = strlen(line);
+        }
+#endif
+        if(line_len > 0)
+        {
+            switch(line[line_len - 1])  // remove newline
+            {
+                case '\n':
+                case '\r':
+                    line[line_len - 1] = 0;
+                    break;
+            }
+
+            p = line;
+            while(*p && *p != separator) p++;
+            if(*p)
+            {
+                *p = 0;
+                p++;
+
+                hash_table_add(data,line,(size_t) (p - line - 1),p);
+            }
+        }
+    } while(line_len != -1);
+    fclose(fp);
+    free(line);
+    hash_table_source(data,efile,before);
+    free(efile);
+}
+
+/* total size and latest modification time of lookup files */
+static void
+lookup_files_stat(struct lookup *l,uint64_t *size,int64_t *mtime)
+{
+#ifdef HAVE_SYS_STAT_H
+    struct lookup_file *lf = l->files;
+    struct stat st;
+    char *efile;
+
+    *size = 0;
+    *mtime = 0;
+    while(lf != NULL)
+    {
+        if(lf->name != NULL)
+        {
+            efile = expand_home(lf->name);
+            if(stat(efile,&st) == 0)
+            {
+                *size += (uint64_t) st.st_size;
+                if((int64_t) st.st_mtime > *mtime) *mtime = (int64_t) st.st_mtime;
+            }
+            free(efile);
+        }
+        lf = lf->next;
+    }
+#else
+    *size = 0;
+    *mtime = 0;
+#endif
+}
+
+/* write the table image to index file, file is written to a temporary
+   file first, so running processes using the old index are not disturbed
+ */
+static void
+write_lookup_index(struct lookup *l,struct hash_table *t)
+{
+    struct index_header h;
+    char *efile,*tmp;
+    FILE *fp;
+    int err = 0;
+
+    memset(&h,0,sizeof(h));
+    strcpy(h.magic,INDEX_MAGIC);
+    h.byte_order = INDEX_BYTE_ORDER;
+    h.slots = (uint64_t) t->size;
+    h.count = (uint64_t) t->count;
+    h.slot_offset = sizeof(h);
+    h.data_offset = h.slot_offset + h.slots * sizeof(struct hash_slot);
+    h.data_size = (uint64_t) t->arena_used;
+    lookup_files_stat(l,&h.source_size,&h.source_mtime);
+
+    efile = expand_home(l->index_file);
+    tmp = xmalloc(strlen(efile) + 5);
+    strcpy(tmp,efile);
+    strcat(tmp,".tmp");
+
+    fp = xfopenb(tmp,"w");
+    if(fwrite(&h,sizeof(h),1,fp) != 1) err = 1;
+    if(!err && fwrite(t->slots,sizeof(struct hash_slot),t->size,fp) != t->size) err = 1;
+    if(!err && t->arena_used && fwrite(t->arena,t->arena_used,1,fp) != 1) err = 1;
+    if(fclose(fp)) err = 1;
+    if(err) panic("Error in writing lookup index",tmp,strerror(errno));
+
+    if(rename(tmp,efile)) panic("Cannot rename lookup index",tmp,strerror(errno));
+
+    free(tmp);
+    free(efile);
+}
+
+/* map index file to memory and make a read only hash table of it */
+static struct hash_table *
+read_lookup_index(struct lookup *l)
+{
+    struct index_header *h;
+    struct hash_table *t;
+    uint8_t *base = NULL;
+    size_t size;
+    long fsize;
+    char *efile;
+    uint64_t source_size;
+    int64_t source_mtime;
+    FILE *fp;
+
+    efile = expand_home(l->index_file);
+
+    fp = fopen(efile,"rb");
+    if(fp == NULL) panic("Cannot open lookup index, build it with option --build-lookup-index",efile,strerror(errno));
+
+    if(fseek(fp,0,SEEK_END)) panic("Cannot read lookup index",efile,strerror(errno));
+    fsize = ftell(fp);
+    if(fsize < 0) panic("Cannot read lookup index",efile,strerror(errno));
+    size = (size_t) fsize;
+    if(size < sizeof(struct index_header)) panic("Invalid lookup index",efile,NULL);
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    base = mmap(NULL,size,PROT_READ,MAP_SHARED,fileno(fp),0);
+    if(base == MAP_FAILED) base = NULL;
+#endif
+    if(base == NULL)
+    {
+        base = xmalloc(size);
+        rewind(fp);
+        if(fread(base,size,1,fp) != 1) panic("Cannot read lookup index",efile,strerror(errno));
+    }
+    fclose(fp);
+
+    h = (struct index_header *) base;
+    if(strcmp(h->magic,INDEX_MAGIC) != 0) panic("Invalid lookup index",efile,NULL);
+    if(h->byte_order != INDEX_BYTE_ORDER) panic("Lookup index is built in a system having different byte order",efile,NULL);
+    if(!h->slots || (h->slots & (h->slots - 1)) || h->count >= h->slots ||
+       h->slots > size / sizeof(struct hash_slot) || h->slot_offset > size || h->data_offset > size || h->data_size > size ||
+       h->slot_offset + h->slots * sizeof(struct hash_slot) > h->data_offset ||
+       h->data_offset + h->data_size > size) panic("Invalid lookup index",efile,NULL);
+
+    if(l->files != NULL)
+    {
+        lookup_files_stat(l,&source_size,&source_mtime);
+        if(source_size != h->source_size || source_mtime != h->source_mtime)
+            problem("Lookup index is out of date, rebuild it with option --build-lookup-index",efile,NULL);
+    }
+
+    t = xmalloc(sizeof(struct hash_table));
+    t->size = (size_t) h->slots;
+    t->count = (size_t) h->count;
+    t->values = 1;
+    t->casefold = 0;
+    t->slots = (struct hash_slot *) (base + h->slot_offset);
+    t->arena = base + h->data_offset;
+    t->arena_size = (size_t) h->data_size;
+    t->arena_used = (size_t) h->data_size;
+    t->bloom = NULL;
+    t->bloom_blocks = 0;
+    t->source = NULL;
+    t->source_count = 0;
+    if(!hash_table_check(t)) panic("Invalid lookup index",efile,NULL);
+
+    free(efile);
+    return t;
+}
+
+/* child of node starting with byte c, i is set to the insertion point if not found */
+static struct radix_node *
+radix_child(struct radix_node *n,uint8_t c,int *i)
+{
+    register int low = 0,high = n->children - 1,mid;
+
+    while(low <= high)
+    {
+        mid = (low + high) / 2;
+        if(n->child[mid]->label[0] == c)
+        {
+            *i = mid;
+            return n->child[mid];
+        }
+        if(n->child[mid]->label[0] < c)
+        {
+            low = mid + 1;
+        } else
+        {
+            high = mid - 1;
+        }
+    }
+    *i = low;
+    return NULL;
+}
+
+static struct radix_node *
+new_radix_node(uint8_t *label,size_t len,uint8_t *value)
+{
+    struct radix_node *n = xmalloc(sizeof(struct radix_node));
+
+    n->label = label;
+    n->label_len = len;
+    n->value = value;
+    n->children = 0;
+    n->child = NULL;
+    return n;
+}
+
+static void
+add_radix_child(struct radix_node *n,struct radix_node *c,int i)
+{
+    n->child = xrealloc(n->child,(n->children + 1) * sizeof(struct radix_node *));
+    memmove(&n->child[i + 1],&n->child[i],(n->children - i) * sizeof(struct radix_node *));
+    n->child[i] = c;
+    n->children++;
+}
+
+/* add key to tree, labels point to the key, so it must not be freed */
+static void
+radix_insert(struct radix_node *n,uint8_t *key,size_t len,uint8_t *value)
+{
+    struct radix_node *c,*m;
+    register size_t p;
+    int i;
+
+    while(len)
+    {
+        c = radix_child(n,key[0],&i);
+        if(c == NULL)
+        {
+            add_radix_child(n,new_radix_node(key,len,value),i);
+            return;
+        }
+
+        p = 1;
+        while(p < c->label_len && p < len && c->label[p] == key[p]) p++;
+
+        if(p < c->label_len)     /* split the edge */
+        {
+            m = new_radix_node(c->label,p,NULL);
+            c->label += p;
+            c->label_len -= p;
+            m->children = 1;
+            m->child = xmalloc(sizeof(struct radix_node *));
+            m->child[0] = c;
+            n->child[i] = m;
+            c = m;
+        }
+
+        key += p;
+        len -= p;
+        n = c;
+    }
+    if(n->value == NULL) n->value = value;
+}
+
+/* make radix tree from all keys in table */
+static struct radix_node *
+make_radix_tree(struct hash_table *t)
+{
+    struct radix_node *root = new_radix_node(NULL,0,NULL);
+    uint8_t *key;
+    size_t len;
+
+    key = hash_table_next(t,NULL);
+    while(key != NULL)
+    {
+        len = hash_table_key_len(key);
+        if(len) radix_insert(root,key,len,key + len + 1);
+        key = hash_table_next(t,key);
+    }
+    return root;
+}
+
+/* find the value of longest key which is a prefix of search,
+   length of the found key is written to match_len
+ */
+uint8_t *
+radix_lookup(struct radix_node *n,uint8_t *search,size_t len,size_t *match_len)
+{
+    uint8_t *ret_val = NULL;
+    size_t matched = 0;
+    int i;
+
+    *match_len = 0;
+    while(len && (n = radix_child(n,*search,&i)) != NULL)
+    {
+        if(n->label_len > len || memcmp(n->label,search,n->label_len) != 0) break;
+        search += n->label_len;
+        len -= n->label_len;
+        matched += n->label_len;
+        if(n->value != NULL)
+        {
+            ret_val = n->value;
+            *match_len = matched;
+        }
+    }
+    return ret_val;
+}
+
+/* read low, high and value rows from file, rows without two separators are omitted */
+static void
+read_range_file(struct range_table *t,char *file,char separator)
+{
+    FILE *fp;
+    register int line_len;
+    size_t max_line_size = 1024;
+    char *efile;
+    char *line;
+    char *high,*value;
+    struct range *r;
+
+    efile = expand_home(file);
+
+    fp = xfopen(efile,"r");
+
+    line = xmalloc(max_line_size);
+
+    do
+    {
+#ifdef HAVE_GETLINE
+        line_len = getline(&line,&max_line_size,fp);
+#else
+        if(fgets(line,max_line_size,fp) == NULL)
+        {
+            line_len = -1;
+        } else
+        {
+            line_len = strlen(line);
+        }
+#endif
+        if(line_len > 0)
+        {
+            switch(line[line_len - 1])  // remove newline
+            {
+                case '\n':
+                case '\r':
+                    line[line_len - 1] = 0;
+                    break;
+            }
+
+            if((high = strchr(line,separator)) != NULL && (value = strchr(high + 1,separator)) != NULL)
+            {
+                if(t->count == t->size)
+                {
+                    t->size = t->size ? t->size * 2 : 1024;
+                    t->r = xrealloc(t->r,t->size * sizeof(struct range));
+                }
+                r = &t->r[t->count];
+                r->low = xstrdup(line);
+                high = (char *) r->low + (high - line);
+                value = (char *) r->low + (value - line);
+                *high++ = 0;
+                *value++ = 0;
+                r->high = high;
+                r->value = value;
+                r->order = t->count++;
+            }
+        }
+    } while(line_len != -1);
+    fclose(fp);
+    free(line);
+    free(efile);
+}
+
+/* convert range bound or search key to number, returns 0 if it is not valid for compare type */
+static int
+range_number(char compare,uint8_t *str,double *n)
+{
+    char *end;
+    unsigned int a,b,c,d;
+    int len;
+
+    switch(compare)
+    {
+        case RANGE_NUMBER:
+            if(!*str) return 0;
+            *n = strtod(str,&end);
+            while(isspace(*end)) end++;
+            return *end == 0;
+        case RANGE_IP:
+            len = 0;
+            if(sscanf(str,"%u.%u.%u.%u%n",&a,&b,&c,&d,&len) != 4 || str[len] || a > 255 || b > 255 || c > 255 || d > 255) return 0;
+            *n = (double) ((a << 24) | (b << 16) | (c << 8) | d);
+            return 1;
+    }
+    return 0;
+}
+
+/* compare type of table being sorted */
+static char range_compare;
+
+static int
+range_cmp(const void *a,const void *b)
+{
+    const struct range *ra = a,*rb = b;
+    int c;
+
+    if(range_compare != RANGE_STRING)
+    {
+        if(ra->nlow < rb->nlow) return -1;
+        if(ra->nlow > rb->nlow) return 1;
+    } else
+    {
+        c = strcmp(ra->low,rb->low);
+        if(c) return c;
+    }
+    /* for equal lows the first row in file is last, so it is found first */
+    return ra->order < rb->order ? 1 : -1;
+}
+
+/* select compare type, sort rows and calculate running maximums of high bounds */
+static void
+init_range_table(struct range_table *t)
+{
+    register size_t i;
+    char compare[] = {RANGE_NUMBER,RANGE_IP,RANGE_STRING};
+    int c;
+
+    for(c = 0;compare[c] != RANGE_STRING;c++)
+    {
+        for(i = 0;i < t->count;i++)
+        {
+            if(!range_number(compare[c],t->r[i].low,&t->r[i].nlow) ||
+               !range_number(compare[c],t->r[i].high,&t->r[i].nhigh)) break;
+        }
+        if(i == t->count) break;
+    }
+    t->compare = compare[c];
+
+    for(i = 0;i < t->count;i++) t->r[i].max_shigh = t->r[i].high;
+
+    range_compare = t->compare;
+    if(t->count) qsort(t->r,t->count,sizeof(struct range),range_cmp);
+
+    for(i = 0;i < t->count;i++)
+    {
+        if(t->compare == RANGE_STRING)
+        {
+            if(i && strcmp(t->r[i - 1].max_shigh,t->r[i].max_shigh) > 0) t->r[i].max_shigh = t->r[i - 1].max_shigh;
+        } else
+        {
+            t->r[i].max_high = t->r[i].nhigh;
+            if(i && t->r[i - 1].max_high > t->r[i].max_high) t->r[i].max_high = t->r[i - 1].max_high;
+        }
+    }
+}
+
+/* return value of interval containing search, the interval having greatest low is
+   selected if there are overlapping intervals. Bounds are inclusive.
+ */
+uint8_t *
+range_lookup(struct range_table *t,uint8_t *search)
+{
+    register size_t low = 0,high,mid;
+    double n = 0;
+    struct range *r;
+    int numeric = t->compare != RANGE_STRING;
+
+    if(!t->count) return NULL;
+    if(numeric && !range_number(t->compare,search,&n)) return NULL;
+
+    /* find the number of rows having low <= search */
+    high = t->count;
+    while(low < high)
+    {
+        mid = (low + high) / 2;
+        if(numeric ? t->r[mid].nlow <= n : strcmp(t->r[mid].low,search) <= 0)
+        {
+            low = mid + 1;
+        } else
+        {
+            high = mid;
+        }
+    }
+
+    /* go back while some of the preceding rows can contain search */
+    while(low--)
+    {
+        r = &t->r[low];
+        if(numeric)
+        {
+            if(r->max_high < n) break;
+            if(r->nhigh >= n) return r->value;
+        } else
+        {
+            if(strcmp(r->max_shigh,search) < 0) break;
+            if(strcmp(r->high,search) >= 0) return r->value;
+        }
+    }
+    return NULL;
+}
+
+/* read lookup files, or indexes for lookups using them.
+   If build_index is set, indexes are written from lookup files
+   returns the number of indexes built
+ */
+int
+init_lookups(int build_index)
+{
+    struct lookup *l = lookup;
+    struct lookup_file *lf;
+    struct hash_table *t;
+    int built = 0;
+
+    while(l != NULL)
+    {
+        if(build_index)
+        {
+            if(l->index_file != NULL)
+            {
+                if(l->files == NULL) panic("Lookup index can be built only from lookup files",l->name,NULL);
+                t = new_hash_table(1);
+                lf = l->files;
+                while(lf != NULL)
+                {
+                    if(lf->name != NULL) read_lookup_from_file(t,lf->name,lf->separator);
+                    lf = lf->next;
+                }
+                write_lookup_index(l,t);
+                built++;
+            }
+        } else if(l->type == RANGE)
+        {
+            if(l->data->count || l->index_file != NULL) panic("Range lookup can be read only from lookup files",l->name,NULL);
+            l->ranges = xmalloc(sizeof(struct range_table));
+            l->ranges->count = 0;
+            l->ranges->size = 0;
+            l->ranges->r = NULL;
+            lf = l->files;
+            while(lf != NULL)
+            {
+                if(lf->name == NULL) panic("Range lookup can be read only from lookup files",l->name,NULL);
+                read_range_file(l->ranges,lf->name,lf->separator);
+                lf = lf->next;
+            }
+            init_range_table(l->ranges);
+        } else
+        {
+            /* files and pairs are added in rc order, the first definition of a key wins.
+               Pairs are searched before an index, so they override it.
+             */
+            if(l->index_file != NULL) l->index = read_lookup_index(l);
+            lf = l->files;
+            while(lf != NULL)
+            {
+                if(lf->name == NULL)
+                {
+                    hash_table_add(l->data,lf->key,strlen((char *) lf->key),lf->value);
+                } else if(l->index_file == NULL)
+                {
+                    read_lookup_from_file(l->data,lf->name,lf->separator);
+                }
+                lf = lf->next;
+            }
+        }
+        if(!build_index && l->type == LONGEST) l->radix = make_radix_tree(l->data);
+        l = l->next;
+    }
+    return built;
+}
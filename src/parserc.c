@@ -120,6 +120,9 @@ char *values[100];            /* poister to option name and parameters */
 #define N_PAIR              "pair"
 #define N_FILE              "file"
 #define N_DEFAULT           "default-value"
+#define N_INDEX             "index"
+#define N_CACHE             "cache"
+#define N_KEY_FIELDS        "key-fields"
 #define N_SEARCH            "search"
 #define N_CONST             "const"
 #define N_FIELD_COUNT       "field-count"
@@ -131,6 +134,13 @@ char *values[100];            /* poister to option name and parameters */
 #define N_VARLEN	    "variable-length"
 #define N_ANON		    "anonymize"
 #define N_METHOD	    "method"
+#define N_HASH_KEY          "hash-key"
+#define N_CACHE_MEMORY      "cache-memory"
+#define N_RANDOM_SEED       "random-seed"
+#define N_TOKEN_VAULT       "token-vault"
+#define N_TRANSFORM         "transform"
+#define N_FUNCTION          "function"
+#define N_CODE_PAGE         "code-page"
 
 
 
@@ -167,6 +177,9 @@ static struct rc_option rc_opts[] = {
     {N_PAIR,"SS"},
     {N_FILE,"Sc"},
     {N_DEFAULT,"S"},
+    {N_INDEX,"S"},
+    {N_CACHE,"N"},
+    {N_KEY_FIELDS,"Sc"},
     {N_SEARCH,"S"},
     {N_CONST,"SS"},
     {N_FIELD_COUNT,"N"},
@@ -174,10 +187,17 @@ static struct rc_option rc_opts[] = {
     {N_LEVEL,"Nss"},
     {N_RECORD_LENGTH,"S"},
     {N_HEX_CAP,"S"},
-    {N_PIPE,"SS"},
+    {N_PIPE,"SSssssssss"},
     {N_VARLEN,"SSn"},
     {N_ANON,"S"},
     {N_METHOD,"SSnns"},
+    {N_HASH_KEY,"S"},
+    {N_CACHE_MEMORY,"S"},
+    {N_RANDOM_SEED,"S"},
+    {N_TOKEN_VAULT,"S"},
+    {N_TRANSFORM,"S"},
+    {N_FUNCTION,"Ssss"},
+    {N_CODE_PAGE,"S"},
     {NULL,NULL}
 };
 
@@ -193,6 +213,7 @@ static struct anon_method methods[] = {
     {"NRANDOM",A_NRANDOM},
     {"HASH",A_HASH},
     {"NHASH",A_NHASH},
+    {"TOKEN",A_TOKEN},
     {NULL,A_UNKNOWN}
 };
 
@@ -234,6 +255,185 @@ error_in_line()
     fprintf(stderr,"%s: Error in rcfile, line %d\n",program,lineno);
 }
 
+/* parse memory size having optional suffix K, M or G */
+static size_t
+parse_size(char *size)
+{
+    char *end;
+    double value = strtod(size,&end);
+
+    switch(toupper(*end))
+    {
+        case 'G':
+            value *= 1024;
+        case 'M':
+            value *= 1024;
+        case 'K':
+            value *= 1024;
+            end++;
+            break;
+    }
+
+    if(end == size || *end || value < 1)
+    {
+        error_in_line();
+        panic("Invalid size",size,NULL);
+    }
+    return (size_t) value;
+}
+
+struct transform_function {
+    char *name;
+    int function;
+    int min_args;
+};
+
+static struct transform_function functions[] = {
+    {"upper",T_UPPER,0},
+    {"lower",T_LOWER,0},
+    {"substr",T_SUBSTR,1},
+    {"pad",T_PAD,1},
+    {"replace",T_REPLACE,2},
+    {"scale",T_SCALE,1},
+    {"date",T_DATE,2},
+    {"charset",T_CHARSET,2},
+    {NULL,T_UNKNOWN,0}
+};
+
+/* make a transformation function from values, args is the number of function arguments */
+static struct transform *
+parse_transform_function(int args)
+{
+    struct transform *t = xmalloc(sizeof(struct transform));
+    char *end;
+    int i = 0;
+
+    while(functions[i].name != NULL && strcmp(functions[i].name,values[1]) != 0) i++;
+
+    if(functions[i].name == NULL)
+    {
+        error_in_line();
+        panic("Unknown transformation function",values[1],NULL);
+    }
+
+    if(args < functions[i].min_args)
+    {
+        error_in_line();
+        panic("Too few parameters for function",values[1],NULL);
+    }
+
+    t->function = functions[i].function;
+    t->start = 1;
+    t->length = 0;
+    t->pad_char = ' ';
+    t->pad_left = 0;
+    t->factor = 1;
+    t->decimals = -1;
+    t->arg[0] = NULL;
+    t->arg[1] = NULL;
+    t->next = NULL;
+
+    switch(t->function)
+    {
+        case T_SUBSTR:
+            if(!is_digit(values[2]) || (args > 1 && !is_digit(values[3])))
+            {
+                error_in_line();
+                panic("A number expected",values[1],NULL);
+            }
+            t->start = atoi(values[2]);
+            if(t->start < 1)
+            {
+                error_in_line();
+                panic("Position must be greater than zero",NULL,NULL);
+            }
+            if(args > 1) t->length = atoi(values[3]);
+            break;
+        case T_PAD:
+            if(!is_digit(values[2]))
+            {
+                error_in_line();
+                panic("A number expected",values[1],NULL);
+            }
+            t->length = atoi(values[2]);
+            if(args > 1) t->pad_char = values[3][0];
+            if(args > 2)
+            {
+                if(strcmp(values[4],"left") == 0)
+                {
+                    t->pad_left = 1;
+                } else if(strcmp(values[4],"right") != 0)
+                {
+                    error_in_line();
+                    panic("left or right expected",values[4],NULL);
+                }
+            }
+            break;
+        case T_REPLACE:
+#ifdef HAVE_REGEX
+            {
+                int rc,buflen;
+                char *errbuf;
+
+                t->arg[0] = xstrdup(values[3]);
+                rc = regcomp(&t->reg,values[2],REG_EXTENDED);
+                if(rc)
+                {
+                    buflen = regerror(rc,&t->reg,NULL,0);
+                    errbuf = xmalloc(buflen + 1);
+                    regerror(rc,&t->reg,errbuf,buflen);
+                    error_in_line();
+                    panic("Error in regular expression",values[2],errbuf);
+                }
+            }
+#else
+            error_in_line();
+            panic("Regular expressions are not supported in this system",NULL,NULL);
+#endif
+            break;
+        case T_SCALE:
+            t->factor = strtod(values[2],&end);
+            if(end == values[2] || *end)
+            {
+                error_in_line();
+                panic("A number expected",values[2],NULL);
+            }
+            if(args > 1)
+            {
+                if(!is_digit(values[3]))
+                {
+                    error_in_line();
+                    panic("A number expected",values[3],NULL);
+                }
+                t->decimals = atoi(values[3]);
+            }
+            break;
+        case T_DATE:
+#ifdef HAVE_STRPTIME
+            t->arg[0] = xstrdup(values[2]);
+            t->arg[1] = xstrdup(values[3]);
+#else
+            error_in_line();
+            panic("Date parsing is not supported in this system",NULL,NULL);
+#endif
+            break;
+        case T_CHARSET:
+#ifdef HAVE_ICONV
+            t->cd = iconv_open(values[3],values[2]);
+            if(t->cd == (iconv_t) -1)
+            {
+                error_in_line();
+                panic("Cannot convert between character sets",values[2],values[3]);
+            }
+#else
+            error_in_line();
+            panic("Character set conversion is not supported in this system",NULL,NULL);
+#endif
+            break;
+    }
+    return t;
+}
+
 /* remove leading and trailing whitespace */
 void
 trim(char *buf)
@@ -809,7 +1009,7 @@ int parse_option(char *buf)
                         }
                         break;
                 }
-                if(valc > 6)
+                if(valc > 10)
                 {
                     error_in_line();
                     panic("Too many parameters",values[0],NULL);
@@ -854,79 +1054,6 @@ expand_home(char *path)
 }
 
 
-/* read key value pairs from file */
-/* to struct lookup data chain */
-void
-read_lookup_from_file(struct lookup_data **data,char *file,char separator)
-{
-    FILE *fp;
-    register int line_len;
-    size_t max_line_size = 1024;
-    char *efile;
-    char *line;
-    register char *p;
-    struct lookup_data *c_data;
-
-    efile = expand_home(file);
-    
-    fp = xfopen(efile,"r");
-
-    line = xmalloc(max_line_size);
-
-    do
-    {
-#ifdef HAVE_GETLINE
-        line_len = getline(&line,&max_line_size,fp);
-#else
-        if(fgets(line,max_line_size,fp) == NULL)
-        {
-            line_len = -1;
-        } else
-        {
-            line_len = strlen(line);
-        }
-#endif
-        if(line_len > 0)
-        {
-            switch(line[line_len - 1])  // remove newline
-            {
-                case '\n':
-                case '\r':
-                    line[line_len - 1] = 0;
-                    break;
-            }
-            
-            p = line;
-            while(*p && *p != separator) p++;
-            if(*p)
-            {
-                *p = 0;
-                p++;
-
-                c_data = data[hash(line,0)];
-
-                if(c_data == NULL) 
-                {
-                    c_data = xmalloc(sizeof(struct lookup_data));
-                    data[hash(line,0)] = c_data;
-                } else
-                {
-                    while(c_data->next != NULL) c_data = c_data->next;
-
-                    c_data->next = xmalloc(sizeof(struct lookup_data));
-                    c_data = c_data->next;
-                }
-                c_data->next = NULL;
-                c_data->key = xstrdup(line);
-                c_data->value = xstrdup(p);
-            }
-        }
-    } while(line_len != -1);
-    fclose(fp);
-    free(line);
-    free(efile);
-}
-
 /* non printable characters in form \xnn will be expanded 
    returns id length
 */
@@ -1135,6 +1262,11 @@ parse_field_type(char *t,struct field *f)
         f->type = F_HEX;
         if(is_digit(&t[7])) sscanf(&t[7],"%i",&f->length);
         f->endianess = F_LITTLE_ENDIAN;
+    } else if (strncmp(t,"comp3_",6) == 0)
+    {
+        f->type = F_COMP3;
+        if(is_digit(&t[6])) sscanf(&t[6],"%i",&f->length);
+        f->endianess = F_BIG_ENDIAN;
     } else
     {
         error_in_line();
@@ -1160,6 +1292,8 @@ parse_field_type(char *t,struct field *f)
 #define PS_W_LOOKUP 9
 #define PS_ANON 10
 #define PS_W_ANON 11
+#define PS_TRANSFORM 12
+#define PS_W_TRANSFORM 13
 
 void
 print_info()
@@ -1213,6 +1347,72 @@ print_info()
     }
 }
 
+#ifdef HAVE_PARSE_PRINTF_FORMAT
+/* check if conversion can be made without snprintf, only a single
+   conversion with flags -, 0, width and precision is accepted */
+static void
+analyse_conversion(struct format *f)
+{
+    char *p = f->conversion;
+    int longs = 0;
+
+    f->fast = FMT_GENERIC;
+    f->left = 0;
+    f->zero = 0;
+    f->width = 0;
+    f->precision = -1;
+
+    if(*p++ != '%') return;
+
+    while(*p == '-' || *p == '0')
+    {
+        if(*p == '-') f->left = 1; else f->zero = 1;
+        p++;
+    }
+    if(f->left) f->zero = 0;
+
+    while(isdigit(*p)) f->width = f->width * 10 + (*p++ - '0');
+    if(*p == '.')
+    {
+        p++;
+        f->precision = 0;
+        while(isdigit(*p)) f->precision = f->precision * 10 + (*p++ - '0');
+    }
+    if(f->width > 256 || f->precision > 256) return;
+
+    while(*p == 'l' && longs < 2)
+    {
+        longs++;
+        p++;
+    }
+
+    f->conv = *p++;
+    if(*p) return;    /* text after conversion */
+
+    switch(f->conv)
+    {
+        case 'd':
+        case 'i':
+            if(f->precision < 0) f->fast = FMT_INT;
+            break;
+        case 'x':
+        case 'X':
+            if(f->precision < 0 && !longs) f->fast = FMT_HEX;
+            break;
+        case 'f':
+            if(longs < 2)
+            {
+                f->fast = FMT_FLOAT;
+                if(f->precision < 0) f->precision = 6;
+            }
+            break;
+        case 's':
+            if(!f->zero && !longs) f->fast = FMT_STRING;
+            break;
+    }
+}
+#endif
+
 struct format *
 parse_conversion(char *conv_spec)
 {
@@ -1225,6 +1425,7 @@ parse_conversion(char *conv_spec)
         ret = xmalloc(sizeof(struct format));
         ret->conversion = xstrdup(conv_spec);
         ret->type = argtypes[0];
+        analyse_conversion(ret);
     }
 #else
     error_in_line();
@@ -1243,11 +1444,11 @@ parserc(char *rcfile,char *include_field_list)
     struct structure *c_structure = structure;
     struct field *c_field = NULL;
     struct pipe *c_pipe = NULL;
+    struct transform *c_transform = NULL;
     struct id *c_id =  NULL;
     struct record *c_record = NULL;
     struct output *c_output = output;
     struct lookup *c_lookup = NULL;
-    struct lookup_data *c_lookup_data = NULL;
     struct include_field *fl = parse_include_list(include_field_list);
     struct anon_field *c_anon = anonymize;
 
@@ -1257,7 +1458,15 @@ parserc(char *rcfile,char *include_field_list)
     int status = PS_MAIN;
     int opt_count;
     int field_count;
+    int i;
     char anon_name[100];
+    uint8_t *anon_secret = NULL;
+    int anon_secret_length = 0;
+    uint8_t *anon_seed = NULL;
+    int anon_seed_length = 0;
+    char *anon_vault = NULL;
+    size_t anon_cache_memory = 0;
+    int anon_cached;
 
     open_rc_file(rcfile);
 
@@ -1300,6 +1509,11 @@ parserc(char *rcfile,char *include_field_list)
                             c_structure->header = 0;
                             c_structure->output_name = NULL;
                             c_structure->vote = 0;
+                            c_structure->framing = FRAME_LF;
+                            c_structure->record_length = 0;
+                            c_structure->code_page_name = NULL;
+                            c_structure->decode = NULL;
+                            c_structure->encode = NULL;
                             c_structure->o = NULL;
                             c_structure->r = NULL;
                             status = PS_W_STRUCT;
@@ -1346,7 +1560,6 @@ parserc(char *rcfile,char *include_field_list)
                             status = PS_W_OUTPUT;
                         } else if(strcmp(values[0],N_LOOKUP) == 0)
                         {
-                            register int i;
                             if(c_lookup == NULL)
                             {
                                 c_lookup = xmalloc(sizeof(struct lookup));
@@ -1360,7 +1573,15 @@ parserc(char *rcfile,char *include_field_list)
                             c_lookup->name = xstrdup(values[1]);
                             c_lookup->type = EXACT;
                             c_lookup->default_value = "";
-                            for(i = 0;i < MAX_EXPR_HASH;i++) c_lookup->data[i] = NULL;
+                            c_lookup->data = new_hash_table(1);
+                            c_lookup->files = NULL;
+                            c_lookup->index_file = NULL;
+                            c_lookup->index = NULL;
+                            c_lookup->radix = NULL;
+                            c_lookup->ranges = NULL;
+                            c_lookup->cache_size = 0;
+                            c_lookup->key_fields = NULL;
+                            c_lookup->key_separator = '|';
                             status = PS_W_LOOKUP;
                         } else if(strcmp(values[0],N_CONST) == 0)
                         {
@@ -1383,6 +1604,7 @@ parserc(char *rcfile,char *include_field_list)
                             c_field->const_data = xstrdup(values[2]);
                             c_field->position = 0;
                             c_field->length = strlen(c_field->const_data);
+                            c_field->decoder = DEC_NONE;
                             c_field->o = NULL;
                             c_field->f = NULL;
                         } else if(strcmp(values[0],N_PIPE) == 0)
@@ -1399,9 +1621,123 @@ parserc(char *rcfile,char *include_field_list)
                             c_pipe->next = NULL;
                             c_pipe->name = xstrdup(values[1]);
                             c_pipe->command = xstrdup(values[2]);
+                            c_pipe->mode = PIPE_ONCE;
+                            c_pipe->t = NULL;
+                            c_pipe->wfd = -1;
+                            c_pipe->rfd = -1;
+                            c_pipe->pid = 0;
+                            c_pipe->timeout = 0;
+                            c_pipe->wbuf = NULL;
+                            c_pipe->wsize = 0;
+                            c_pipe->wlen = 0;
+                            c_pipe->rbuf = NULL;
+                            c_pipe->rsize = 0;
+                            c_pipe->rpos = 0;
+                            c_pipe->rlen = 0;
+                            c_pipe->cache = NULL;
+                            c_pipe->batch = 0;
+                            c_pipe->batch_values = NULL;
+                            c_pipe->batch_results = NULL;
+                            for(i = 3;i <= opt_count;i++)
+                            {
+                                if(strcmp(values[i],"persistent") == 0)
+                                {
+                                    c_pipe->mode = PIPE_LINES;
+                                    if(i < opt_count && strcmp(values[i + 1],"lines") == 0)
+                                    {
+                                        i++;
+                                    } else if(i < opt_count && strcmp(values[i + 1],"length") == 0)
+                                    {
+                                        c_pipe->mode = PIPE_LENGTH;
+                                        i++;
+                                    }
+                                } else if(strcmp(values[i],"cache") == 0)
+                                {
+                                    if(i == opt_count || !is_digit(values[i + 1]) || atoi(values[i + 1]) < 1)
+                                    {
+                                        error_in_line();
+                                        panic("Cache size expected",values[1],NULL);
+                                    }
+                                    c_pipe->cache = new_value_cache(atoi(values[++i]));
+                                } else if(strcmp(values[i],"batch") == 0)
+                                {
+                                    if(i == opt_count || !is_digit(values[i + 1]) || atoi(values[i + 1]) < 1)
+                                    {
+                                        error_in_line();
+                                        panic("Batch size expected",values[1],NULL);
+                                    }
+                                    c_pipe->batch = atoi(values[++i]);
+                                } else if(strcmp(values[i],"timeout") == 0)
+                                {
+                                    if(i == opt_count || !is_digit(values[i + 1]) || atoi(values[i + 1]) < 1)
+                                    {
+                                        error_in_line();
+                                        panic("Timeout in seconds expected",values[1],NULL);
+                                    }
+                                    c_pipe->timeout = atoi(values[++i]);
+                                } else
+                                {
+                                    error_in_line();
+                                    panic("Unknown filter option",values[i],NULL);
+                                }
+                            }
+                            if(c_pipe->mode == PIPE_ONCE)
+                            {
+                                if(c_pipe->timeout)
+                                {
+                                    error_in_line();
+                                    panic("Timeout can be used only with a persistent filter",values[1],NULL);
+                                }
+                                if(c_pipe->batch) c_pipe->mode = PIPE_BATCH;
+                            } else if(!c_pipe->batch)
+                            {
+                                c_pipe->batch = PERSISTENT_BATCH;
+                            }
+                            if(c_pipe->batch)
+                            {
+                                c_pipe->batch_values = new_hash_table(0);
+                                c_pipe->batch_results = new_hash_table(1);
+                            }
+                        } else if(strcmp(values[0],N_TRANSFORM) == 0)
+                        {
+                            if (pipes == NULL)
+                            {
+                                c_pipe = xmalloc(sizeof(struct pipe));
+                                pipes = c_pipe;
+                            } else
+                            {
+                                c_pipe->next = xmalloc(sizeof(struct pipe));
+                                c_pipe = c_pipe->next;
+                            }
+                            c_pipe->next = NULL;
+                            c_pipe->name = xstrdup(values[1]);
+                            c_pipe->command = NULL;
+                            c_pipe->mode = PIPE_BUILTIN;
+                            c_pipe->t = NULL;
+                            c_pipe->cache = NULL;
+                            c_pipe->batch = 0;
+                            c_pipe->batch_values = NULL;
+                            c_pipe->batch_results = NULL;
+                            c_pipe->wfd = -1;
+                            c_pipe->rfd = -1;
+                            c_pipe->pid = 0;
+                            c_pipe->timeout = 0;
+                            c_pipe->wbuf = NULL;
+                            c_pipe->wsize = 0;
+                            c_pipe->wlen = 0;
+                            c_pipe->rbuf = NULL;
+                            c_pipe->rsize = 0;
+                            c_pipe->rpos = 0;
+                            c_pipe->rlen = 0;
+                            c_transform = NULL;
+                            status = PS_W_TRANSFORM;
                         } else if(strcmp(values[0],N_ANON) == 0)
                         {
                             strcpy(anon_name,values[1]);
+                            anon_secret = NULL;
+                            anon_seed = NULL;
+                            anon_vault = NULL;
+                            anon_cache_memory = 0;
                             status = PS_W_ANON;
                         } else 
                         {
@@ -1489,6 +1825,9 @@ parserc(char *rcfile,char *include_field_list)
                             c_record->i = NULL;
                             c_record->f = NULL;
                             c_record->fields_from = NULL;
+                            c_record->pf = NULL;
+                            c_record->pf_count = 0;
+                            c_record->last_field = NULL;
                             c_record->o = NULL;
                             c_record->output_name = NULL;
                             c_record->vote = 0;
@@ -1499,6 +1838,37 @@ parserc(char *rcfile,char *include_field_list)
                             c_record->var_field_name = NULL;
                             c_record->level = NULL;
                             status = PS_W_RECORD;
+                        } else if(strcmp(values[0],N_RECORD_LENGTH) == 0)
+                        {
+                            if(strcmp(values[1],"rdw") == 0)
+                            {
+                                c_structure->framing = FRAME_RDW;
+                            } else if(strcmp(values[1],"bdw") == 0)
+                            {
+                                c_structure->framing = FRAME_BDW;
+                            } else if(is_digit(values[1]))
+                            {
+                                c_structure->framing = FRAME_FIXED;
+                                sscanf(values[1],"%d",&c_structure->record_length);
+                                if(c_structure->record_length < 1 || c_structure->record_length > MAX_FRAMED_RECORD)
+                                {
+                                    error_in_line();
+                                    panic("Invalid record length",values[1],NULL);
+                                }
+                            } else
+                            {
+                                error_in_line();
+                                panic("A number, rdw or bdw expected",values[1],NULL);
+                            }
+                        } else if(strcmp(values[0],N_CODE_PAGE) == 0)
+                        {
+                            c_structure->code_page_name = xstrdup(values[1]);
+                            c_structure->decode = code_page_table(values[1]);
+                            if(c_structure->decode == NULL)
+                            {
+                                error_in_line();
+                                panic("Unknown code page",values[1],NULL);
+                            }
                         } else if(strcmp(values[0],N_QUOTE) == 0)
                         {
                             if(opt_count > 0)
@@ -1579,6 +1949,7 @@ parserc(char *rcfile,char *include_field_list)
                             c_field->const_data = NULL;
                             c_field->length = 0;
                             c_field->var_length = 0;
+                            c_field->decoder = DEC_NONE;
                             c_field->output_name = NULL;
                             c_field->o = NULL;
                             c_field->pipe_name = NULL;
@@ -1666,6 +2037,7 @@ parserc(char *rcfile,char *include_field_list)
                                 c_field->const_data = NULL;
                                 c_field->length = 0;
                                 c_field->var_length = 0;
+                                c_field->decoder = DEC_NONE;
                                 c_field->name = NULL;
                                 c_field->output_name = NULL;
                                 c_field->o = NULL;
@@ -1845,6 +2217,9 @@ parserc(char *rcfile,char *include_field_list)
                             } else if(strcmp(values[1],"longest") == 0)
                             {
                                 c_lookup->type = LONGEST;
+                            } else if(strcmp(values[1],"range") == 0)
+                            {
+                                c_lookup->type = RANGE;
                             } else
                             {
                                 error_in_line();
@@ -1852,34 +2227,58 @@ parserc(char *rcfile,char *include_field_list)
                             }
                         } else if(strcmp(values[0],N_PAIR) == 0)
                         {
-                            c_lookup_data = c_lookup->data[hash(values[1],0)];
-
-                            if(c_lookup_data == NULL)
+                            if(c_lookup->files == NULL)
                             {
-                                c_lookup_data = xmalloc(sizeof(struct lookup_data));
-                                c_lookup->data[hash(values[1],0)] = c_lookup_data;
+                                hash_table_add(c_lookup->data,values[1],strlen(values[1]),values[2]);
                             } else
                             {
-                                while(c_lookup_data->next != NULL) c_lookup_data = c_lookup_data->next;
+                                /* files are read later, keep the pair in its place after them */
+                                struct lookup_file *lf = xmalloc(sizeof(struct lookup_file)),*last;
 
-                                c_lookup_data->next = xmalloc(sizeof(struct lookup_data));
-                                c_lookup_data = c_lookup_data->next;
+                                lf->name = NULL;
+                                lf->key = xstrdup(values[1]);
+                                lf->value = xstrdup(values[2]);
+                                lf->next = NULL;
+                                last = c_lookup->files;
+                                while(last->next != NULL) last = last->next;
+                                last->next = lf;
                             }
-                            c_lookup_data->next = NULL;
-                            c_lookup_data->key = xstrdup(values[1]);
-                            c_lookup_data->value = xstrdup(values[2]);
                         } else if(strcmp(values[0],N_FILE) == 0)
                         {
-                            if(opt_count == 1)
+                            struct lookup_file *lf = xmalloc(sizeof(struct lookup_file)),*last;
+
+                            lf->name = xstrdup(values[1]);
+                            lf->separator = opt_count == 1 ? ';' : values[2][0];
+                            lf->key = NULL;
+                            lf->value = NULL;
+                            lf->next = NULL;
+                            if(c_lookup->files == NULL)
                             {
-                                read_lookup_from_file(c_lookup->data,values[1],';');
+                                c_lookup->files = lf;
                             } else
                             {
-                                read_lookup_from_file(c_lookup->data,values[1],values[2][0]);
+                                last = c_lookup->files;
+                                while(last->next != NULL) last = last->next;
+                                last->next = lf;
                             }
                         } else if(strcmp(values[0],N_DEFAULT) == 0)
                         {
                             c_lookup->default_value = xstrdup(values[1]);
+                        } else if(strcmp(values[0],N_INDEX) == 0)
+                        {
+                            c_lookup->index_file = xstrdup(values[1]);
+                        } else if(strcmp(values[0],N_CACHE) == 0)
+                        {
+                            if(!is_digit(values[1]) || atoi(values[1]) < 1)
+                            {
+                                error_in_line();
+                                panic("Cache size expected",values[1],NULL);
+                            }
+                            c_lookup->cache_size = (size_t) atoi(values[1]);
+                        } else if(strcmp(values[0],N_KEY_FIELDS) == 0)
+                        {
+                            c_lookup->key_fields = xstrdup(values[1]);
+                            if(opt_count > 1) c_lookup->key_separator = values[2][0];
                         } else 
                         {
                             error_in_line();
@@ -1911,6 +2310,15 @@ parserc(char *rcfile,char *include_field_list)
                         c_anon->next = NULL;
                         c_anon->key_length = 0;
                         c_anon->key = NULL;
+                        c_anon->secret_length = 0;
+                        c_anon->secret = NULL;
+                        c_anon->siphash = 0;
+                        c_anon->md = NULL;
+                        c_anon->cache = NULL;
+                        c_anon->seed_length = 0;
+                        c_anon->seed = NULL;
+                        c_anon->vault_file = NULL;
+                        c_anon->vault = NULL;
 
                         if(opt_count > 2)
                         {
@@ -1928,20 +2336,53 @@ parserc(char *rcfile,char *include_field_list)
                                 if(opt_count > 4)
                                 {
                                     c_anon->key_length = expand_non_print(values[5],&c_anon->key);
+                                    if((c_anon->method == A_HASH || c_anon->method == A_NHASH) && strcmp((char *) c_anon->key,"siphash") == 0)
+                                        c_anon->siphash = 1;
                                 }
                             }
                         }
+                        } else if(strcmp(values[0],N_HASH_KEY) == 0)
+                        {
+                            anon_secret_length = expand_non_print(values[1],&anon_secret);
+                        } else if(strcmp(values[0],N_CACHE_MEMORY) == 0)
+                        {
+                            anon_cache_memory = parse_size(values[1]);
+                        } else if(strcmp(values[0],N_RANDOM_SEED) == 0)
+                        {
+                            anon_seed_length = expand_non_print(values[1],&anon_seed);
+                        } else if(strcmp(values[0],N_TOKEN_VAULT) == 0)
+                        {
+                            anon_vault = xstrdup(values[1]);
                         } else
                         {
                             error_in_line();
                             panic("Unknown option for anonymize",values[0],NULL);
                         }
                         break;
+                    case PS_TRANSFORM:
+                        if(strcmp(values[0],N_FUNCTION) == 0)
+                        {
+                            if(c_transform == NULL)
+                            {
+                                c_transform = parse_transform_function(opt_count - 1);
+                                c_pipe->t = c_transform;
+                            } else
+                            {
+                                c_transform->next = parse_transform_function(opt_count - 1);
+                                c_transform = c_transform->next;
+                            }
+                        } else
+                        {
+                            error_in_line();
+                            panic("Unknown option for transform",values[0],NULL);
+                        }
+                        break;
                     case PS_W_RECORD:
                     case PS_W_OUTPUT:
                     case PS_W_STRUCT:
                     case PS_W_LOOKUP:
                     case PS_W_ANON:
+                    case PS_W_TRANSFORM:
                         error_in_line();
                         panic("{ expected, found",values[0],NULL);
                         break;
@@ -1965,6 +2406,9 @@ parserc(char *rcfile,char *include_field_list)
                     case PS_W_ANON:
                         status = PS_ANON;
                         break;
+                    case PS_W_TRANSFORM:
+                        status = PS_TRANSFORM;
+                        break;
                     default:
                         error_in_line();
                         panic("{ not expected",NULL,NULL);
@@ -1974,10 +2418,57 @@ parserc(char *rcfile,char *include_field_list)
             case LL_BLOCK_END:
                 switch(status)
                 {
+                    case PS_ANON:   /* hash key, random seed, token vault and cache memory are for all methods in the block */
+                        anon_cached = 0;
+                        c_anon = anonymize;
+                        while(c_anon != NULL)
+                        {
+                            if(strcmp(c_anon->anon_name,anon_name) == 0)
+                            {
+                                if(anon_secret != NULL && c_anon->secret == NULL)
+                                {
+                                    c_anon->secret = anon_secret;
+                                    c_anon->secret_length = anon_secret_length;
+                                }
+                                if(anon_seed != NULL && c_anon->seed == NULL)
+                                {
+                                    c_anon->seed = anon_seed;
+                                    c_anon->seed_length = anon_seed_length;
+                                }
+                                if(c_anon->method == A_TOKEN)
+                                {
+                                    if(anon_vault == NULL)
+                                    {
+                                        error_in_line();
+                                        panic("Anonymization method TOKEN needs a token vault",anon_name,NULL);
+                                    }
+                                    if(c_anon->vault_file == NULL) c_anon->vault_file = anon_vault;
+                                }
+                                if(c_anon->method == A_HASH || c_anon->method == A_NHASH || c_anon->method == A_TOKEN) anon_cached++;
+                            }
+                            if(c_anon->next == NULL) break;
+                            c_anon = c_anon->next;
+                        }
+                        if(anon_cache_memory && anon_cached)
+                        {
+                            c_anon = anonymize;
+                            while(c_anon != NULL)
+                            {
+                                if(strcmp(c_anon->anon_name,anon_name) == 0 && c_anon->cache == NULL &&
+                                   (c_anon->method == A_HASH || c_anon->method == A_NHASH || c_anon->method == A_TOKEN))
+                                {
+                                    c_anon->cache = new_value_cache_memory(anon_cache_memory / anon_cached);
+                                }
+                                if(c_anon->next == NULL) break;
+                                c_anon = c_anon->next;
+                            }
+                        }
+                        status = PS_MAIN;
+                        break;
                     case PS_STRUCT:
                     case PS_OUTPUT:
                     case PS_LOOKUP:
-                    case PS_ANON:
+                    case PS_TRANSFORM:
                         status = PS_MAIN;
                         break;
                     case PS_RECORD:
@@ -0,0 +1,262 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Whole line prefilter for expressions.
+ * If every possible match of the expression requires that some field
+ * contains one of a set of literal strings, the raw input line must also
+ * contain one of them. Lines not containing any of the literals are skipped
+ * before the record is selected and the fields are parsed.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* more literals than this makes the scan slower than parsing */
+#define PREFILTER_MAX_LITERALS 256
+
+struct literal {
+    uint8_t *text;
+    size_t len;
+    struct literal *next;
+};
+
+/* the only literal, if there is just one */
+static struct literal *single_literal = NULL;
+
+/* literals indexed by the first byte, lines are scanned
+   for the first two bytes of literals using the pair bitmap */
+static struct literal *first_byte[256];
+static uint8_t single_byte[256];
+static uint8_t pair_bitmap[65536 / 8];
+
+static void
+free_literals(struct literal *l)
+{
+    struct literal *n;
+
+    while(l != NULL)
+    {
+        n = l->next;
+        free(l);
+        l = n;
+    }
+}
+
+/* can field values be found as such from the raw line */
+static int
+raw_field(struct structure *s,char *name)
+{
+    struct record *r = s->r;
+    struct field *f;
+
+    while(r != NULL)
+    {
+        f = r->f;
+        while(f != NULL)
+        {
+            if(f->name != NULL && strcasecmp(f->name,name) == 0)
+            {
+                if(f->p != NULL || f->const_data != NULL) return 0;
+            }
+            f = f->next;
+        }
+        r = r->next;
+    }
+    return 1;
+}
+
+/* collect the literals required by a node, returns the literal count or -1 if
+   the node does not require any literal */
+static int
+collect_literals(struct structure *s,struct expr_node *n,struct literal **list)
+{
+    struct expression *e;
+    struct literal *l,*best = NULL,*child;
+    uint8_t *v;
+    int i,count,child_count,best_count = -1;
+
+    *list = NULL;
+
+    switch(n->type)
+    {
+        case EN_LEAF:
+            e = n->e;
+            if(e->op != OP_EQUAL && e->op != OP_START && e->op != OP_CONTAINS) return -1;
+            if(!raw_field(s,e->field)) return -1;
+            count = 0;
+            v = hash_table_next(e->values,NULL);
+            while(v != NULL)
+            {
+                if(!hash_table_key_len(v) ||
+                   (s->quote && (strchr((char *) v,s->quote) != NULL || strchr((char *) v,'\\') != NULL)))
+                {
+                    free_literals(*list);
+                    *list = NULL;
+                    return -1;
+                }
+                l = xmalloc(sizeof(struct literal));
+                l->text = v;
+                l->len = hash_table_key_len(v);
+                l->next = *list;
+                *list = l;
+                count++;
+                v = hash_table_next(e->values,v);
+            }
+            return count;
+        case EN_NOT:
+            return -1;
+        case EN_OR:
+            count = 0;
+            for(i = 0;i < n->children;i++)
+            {
+                child_count = collect_literals(s,n->child[i],&child);
+                if(child_count < 0)
+                {
+                    free_literals(*list);
+                    *list = NULL;
+                    return -1;
+                }
+                count += child_count;
+                if(child != NULL)
+                {
+                    l = child;
+                    while(l->next != NULL) l = l->next;
+                    l->next = *list;
+                    *list = child;
+                }
+            }
+            return count;
+        case EN_AND:    /* use the child having smallest set */
+            for(i = 0;i < n->children;i++)
+            {
+                child_count = collect_literals(s,n->child[i],&child);
+                if(child_count >= 0 && (best_count < 0 || child_count < best_count))
+                {
+                    free_literals(best);
+                    best = child;
+                    best_count = child_count;
+                } else
+                {
+                    free_literals(child);
+                }
+            }
+            *list = best;
+            return best_count;
+    }
+    return -1;
+}
+
+/* initialize prefilter for structure, returns 1 if lines can be prefiltered.
+   Skipped lines must not affect the output, so levels and file trailers
+   (which depend on the previous record) disable the prefilter. Literals are
+   not in the input code page, so translated input is not prefiltered */
+int
+init_prefilter(struct structure *s)
+{
+    struct literal *literals,*l,*n;
+    struct record *r;
+    unsigned int pair;
+    int count;
+
+    if(expression_tree == NULL || s->type[0] == BINARY || s->o->file_trailer != NULL || s->decode != NULL) return 0;
+
+    r = s->r;
+    while(r != NULL)
+    {
+        if(r->level != NULL) return 0;
+        r = r->next;
+    }
+
+    count = collect_literals(s,expression_tree,&literals);
+    if(count <= 0 || count > PREFILTER_MAX_LITERALS)
+    {
+        free_literals(literals);
+        return 0;
+    }
+
+    single_literal = count == 1 ? literals : NULL;
+
+    memset(first_byte,0,sizeof(first_byte));
+    memset(single_byte,0,sizeof(single_byte));
+    memset(pair_bitmap,0,sizeof(pair_bitmap));
+
+    l = literals;
+    while(l != NULL)
+    {
+        if(l->len == 1)
+        {
+            single_byte[l->text[0]] = 1;
+        } else
+        {
+            pair = ((unsigned int) l->text[0] << 8) | l->text[1];
+            pair_bitmap[pair >> 3] |= 1 << (pair & 7);
+        }
+        l = l->next;
+    }
+
+    /* bucket lists for verifying */
+    l = literals;
+    while(l != NULL)
+    {
+        n = l->next;
+        l->next = first_byte[l->text[0]];
+        first_byte[l->text[0]] = l;
+        l = n;
+    }
+    return 1;
+}
+
+/* returns 1 if line contains some of the literals */
+int
+prefilter_line(uint8_t *line,int len)
+{
+    register uint8_t *p = line;
+    register uint8_t *end = line + len;
+    register unsigned int pair;
+    struct literal *l;
+
+#ifdef HAVE_MEMMEM
+    if(single_literal != NULL)
+        return memmem(line,(size_t) len,single_literal->text,single_literal->len) != NULL;
+#endif
+
+    while(p < end)
+    {
+        if(single_byte[*p]) return 1;
+        if(p + 1 < end)
+        {
+            pair = ((unsigned int) p[0] << 8) | p[1];
+            if(pair_bitmap[pair >> 3] & (1 << (pair & 7)))
+            {
+                l = first_byte[*p];
+                while(l != NULL)
+                {
+                    if(l->len <= (size_t) (end - p) && memcmp(p,l->text,l->len) == 0) return 1;
+                    l = l->next;
+                }
+            }
+        }
+        p++;
+    }
+    return 0;
+}
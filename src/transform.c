@@ -0,0 +1,269 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Built-in transformation functions for filters.
+ * Functions are applied in order, output of a function is the input
+ * of the next one. Two work buffers are used by turns, the input of
+ * a function is never in the buffer it is writing to.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+static uint8_t *work[2] = {NULL,NULL};
+static size_t work_size[2] = {0,0};
+
+/* subject of regexec and strtod, must be null terminated */
+static char *subject = NULL;
+static size_t subject_size = 0;
+
+static uint8_t *
+reserve(int b,size_t size)
+{
+    if(size > work_size[b])
+    {
+        work_size[b] = size + 1024;
+        work[b] = xrealloc(work[b],work_size[b]);
+    }
+    return work[b];
+}
+
+static char *
+make_subject(uint8_t *data,int len)
+{
+    if((size_t) len >= subject_size)
+    {
+        subject_size = (size_t) len + 1024;
+        subject = xrealloc(subject,subject_size);
+    }
+    memcpy(subject,data,len);
+    subject[len] = 0;
+    return subject;
+}
+
+#if HAVE_REGEX
+/* replace all matches, \0 - \9 in replacement are replaced by subexpressions */
+static int
+regex_replace(struct transform *t,uint8_t *data,int len,int b)
+{
+    char *s = make_subject(data,len);
+    char *r;
+    regmatch_t m[10];
+    size_t out = 0,need;
+    int flags = 0,n;
+    uint8_t *o;
+
+    while(*s && regexec(&t->reg,s,10,m,flags) == 0)
+    {
+        need = out + m[0].rm_so + strlen(t->arg[0]) + len + 1;
+        r = t->arg[0];
+        while(*r)
+        {
+            if(r[0] == '\\' && isdigit(r[1]) && m[r[1] - '0'].rm_so >= 0)
+                need += m[r[1] - '0'].rm_eo - m[r[1] - '0'].rm_so;
+            r++;
+        }
+        o = reserve(b,need);
+
+        memcpy(&o[out],s,m[0].rm_so);
+        out += m[0].rm_so;
+
+        r = t->arg[0];
+        while(*r)
+        {
+            if(r[0] == '\\' && isdigit(r[1]))
+            {
+                n = r[1] - '0';
+                if(m[n].rm_so >= 0)
+                {
+                    memcpy(&o[out],&s[m[n].rm_so],m[n].rm_eo - m[n].rm_so);
+                    out += m[n].rm_eo - m[n].rm_so;
+                }
+                r += 2;
+            } else
+            {
+                if(r[0] == '\\' && r[1] == '\\') r++;
+                o[out++] = (uint8_t) *r++;
+            }
+        }
+
+        if(m[0].rm_eo == m[0].rm_so)   /* empty match, copy one character */
+        {
+            if(!s[m[0].rm_eo])
+            {
+                s += m[0].rm_eo;
+                break;
+            }
+            o[out++] = (uint8_t) s[m[0].rm_eo];
+            s += m[0].rm_eo + 1;
+        } else
+        {
+            s += m[0].rm_eo;
+        }
+        flags = REG_NOTBOL;
+    }
+
+    need = strlen(s);
+    o = reserve(b,out + need + 1);
+    memcpy(&o[out],s,need);
+    out += need;
+    return (int) out;
+}
+#endif
+
+/* apply functions to data, pointer to the result is written to output.
+   Returns the result length */
+int
+execute_transform(uint8_t *data,int len,struct transform *t,uint8_t **output)
+{
+    int b = -1;           /* work buffer containing data, -1 = data is not in work buffers */
+    int o,i,n;
+    uint8_t *out;
+    char *s,*end;
+    double value;
+    struct tm tm;
+    size_t size;
+#ifdef HAVE_ICONV
+    char *inp,*outp;
+    size_t inleft,outleft;
+#endif
+
+    while(t != NULL)
+    {
+        o = b == 0 ? 1 : 0;
+        out = NULL;
+
+        switch(t->function)
+        {
+            case T_UPPER:
+                out = reserve(o,len + 1);
+                for(i = 0;i < len;i++) out[i] = toupper(data[i]);
+                break;
+            case T_LOWER:
+                out = reserve(o,len + 1);
+                for(i = 0;i < len;i++) out[i] = tolower(data[i]);
+                break;
+            case T_SUBSTR:      /* points to the same buffer */
+                if(t->start > len)
+                {
+                    len = 0;
+                } else
+                {
+                    n = len - t->start + 1;
+                    if(t->length && t->length < n) n = t->length;
+                    data += t->start - 1;
+                    len = n;
+                }
+                break;
+            case T_PAD:
+                if(len < t->length)
+                {
+                    out = reserve(o,t->length + 1);
+                    n = t->length - len;
+                    if(t->pad_left)
+                    {
+                        memset(out,t->pad_char,n);
+                        memcpy(&out[n],data,len);
+                    } else
+                    {
+                        memcpy(out,data,len);
+                        memset(&out[len],t->pad_char,n);
+                    }
+                    len = t->length;
+                }
+                break;
+#if HAVE_REGEX
+            case T_REPLACE:
+                len = regex_replace(t,data,len,o);
+                out = work[o];
+                break;
+#endif
+            case T_SCALE:
+                s = make_subject(data,len);
+                value = strtod(s,&end);     /* values that are not wholly numeric are kept as such */
+                if(end != s)
+                {
+                    while(isspace(*end)) end++;
+                }
+                if(end != s && !*end)
+                {
+                    out = reserve(o,512);
+                    if(t->decimals < 0)
+                    {
+                        len = snprintf((char *) out,512,"%.15g",value * t->factor);
+                    } else
+                    {
+                        len = snprintf((char *) out,512,"%.*f",t->decimals,value * t->factor);
+                    }
+                    if(len >= 512) len = 511;
+                }
+                break;
+#ifdef HAVE_STRPTIME
+            case T_DATE:    /* values not matching the input format are kept as such */
+                s = make_subject(data,len);
+                memset(&tm,0,sizeof(tm));
+                end = strptime(s,t->arg[0],&tm);
+                if(end != NULL)
+                {
+                    while(isspace(*end)) end++;
+                    if(!*end)
+                    {
+                        out = reserve(o,256 + strlen(t->arg[1]) * 4);
+                        size = strftime((char *) out,work_size[o],t->arg[1],&tm);
+                        if(size) len = (int) size; else out = NULL;
+                    }
+                }
+                break;
+#endif
+#ifdef HAVE_ICONV
+            case T_CHARSET:
+                out = reserve(o,len * 4 + 16);
+                inp = (char *) data;
+                inleft = len;
+                outp = (char *) out;
+                outleft = work_size[o];
+                iconv(t->cd,NULL,NULL,NULL,NULL);
+                if(iconv(t->cd,&inp,&inleft,&outp,&outleft) == (size_t) -1 ||
+                   iconv(t->cd,NULL,NULL,&outp,&outleft) == (size_t) -1)
+                {
+                    out = NULL;    /* not convertable, keep the original */
+                } else
+                {
+                    len = (int) (outp - (char *) out);
+                }
+                break;
+#endif
+        }
+
+        if(out != NULL)
+        {
+            data = out;
+            b = o;
+        }
+        t = t->next;
+    }
+    *output = data;
+    return len;
+}
@@ -0,0 +1,336 @@
+/*
+ *    ffe - Flat File Extractor
+ *
+ *    Copyright (C) 2006 Timo Savinen
+ *    This file is part of ffe.
+ *
+ *    ffe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    ffe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with ffe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Token vault for anonymization method TOKEN.
+ * The vault file is a header, two bucket tables and records appended to
+ * the end of the file. Records are chained from the key table by the value
+ * and from the token table by the token, so both the token of a value and
+ * the uniqueness of a new token are checked in constant time.
+ *
+ * The file is mapped to memory and shared by concurrent ffe processes.
+ * Searches are made under a read lock and additions under a write lock,
+ * record data is never changed after it is added.
+ * When there are more records than buckets, tables of double size are
+ * appended to the file and the records are chained to them. The header
+ * tells where the current tables are, the old ones are left unused.
+ */
+
+#include "ffe.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
+
+#define VAULT_MAGIC "ffevault2"
+#define VAULT_BYTE_ORDER 0x01020304
+#define VAULT_BUCKETS 262144
+#define VAULT_GROW (1024 * 1024)
+#define VAULT_TRIES 100
+
+struct vault_header {
+    char magic[16];
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t buckets;
+    uint64_t count;
+    uint64_t used;          /* end of the last record */
+    uint64_t table;         /* offset of the key table, the token table follows it */
+};
+
+struct vault_record {
+    uint64_t next_value;    /* offset of next record in the same key bucket, 0 = last */
+    uint64_t next_token;    /* offset of next record in the same token bucket */
+    uint32_t value_len;
+    uint32_t token_len;     /* value bytes are followed by token bytes */
+};
+
+struct token_vault {
+    char *file;
+    int fd;
+    uint8_t *base;
+    size_t size;            /* mapped size */
+    struct token_vault *next;
+};
+
+static struct token_vault *vaults = NULL;
+
+#define HEADER(v) ((struct vault_header *) (v)->base)
+#define VALUE_BUCKETS(v) ((uint64_t *) ((v)->base + HEADER(v)->table))
+#define TOKEN_BUCKETS(v) (VALUE_BUCKETS(v) + HEADER(v)->buckets)
+#define RECORD(v,o) ((struct vault_record *) ((v)->base + (o)))
+#define RECORD_DATA(r) ((uint8_t *) (r) + sizeof(struct vault_record))
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+static void
+vault_lock(struct token_vault *v,short type)
+{
+    struct flock l;
+
+    l.l_type = type;
+    l.l_whence = SEEK_SET;
+    l.l_start = 0;
+    l.l_len = 0;
+
+    while(fcntl(v->fd,F_SETLKW,&l) == -1)
+    {
+        if(errno != EINTR) panic("Cannot lock token vault",v->file,strerror(errno));
+    }
+}
+
+/* map the whole file, file can be grown by other processes */
+static void
+vault_map(struct token_vault *v)
+{
+    off_t size = lseek(v->fd,0,SEEK_END);
+
+    if(size < 0) panic("Cannot read token vault",v->file,strerror(errno));
+    if((size_t) size == v->size) return;
+
+    if(v->base != NULL) munmap(v->base,v->size);
+    v->base = mmap(NULL,(size_t) size,PROT_READ | PROT_WRITE,MAP_SHARED,v->fd,0);
+    if(v->base == MAP_FAILED) panic("Cannot map token vault",v->file,strerror(errno));
+    v->size = (size_t) size;
+}
+
+static void
+vault_grow(struct token_vault *v,size_t need)
+{
+    size_t size = v->size;
+
+    if(need <= size) return;
+    while(size < need) size += size < VAULT_GROW ? size : VAULT_GROW;
+    if(ftruncate(v->fd,(off_t) size) == -1) panic("Cannot extend token vault",v->file,strerror(errno));
+    vault_map(v);
+}
+
+static void
+vault_create(struct token_vault *v)
+{
+    size_t size = sizeof(struct vault_header) + 2 * VAULT_BUCKETS * sizeof(uint64_t);
+    struct vault_header *h;
+
+    if(ftruncate(v->fd,(off_t) size) == -1) panic("Cannot create token vault",v->file,strerror(errno));
+    vault_map(v);
+    h = HEADER(v);
+    strcpy(h->magic,VAULT_MAGIC);
+    h->byte_order = VAULT_BYTE_ORDER;
+    h->buckets = VAULT_BUCKETS;
+    h->count = 0;
+    h->used = size;
+    h->table = sizeof(struct vault_header);
+}
+
+/* chain all records to new tables having double bucket count, called under the write lock */
+static void
+vault_rehash(struct token_vault *v)
+{
+    struct vault_header *h;
+    struct vault_record *r;
+    uint64_t *old_values,*values,*tokens;
+    uint64_t buckets,table,old_buckets,i,o,next,vh,th;
+    size_t need;
+
+    old_buckets = HEADER(v)->buckets;
+    buckets = 2 * old_buckets;
+    table = HEADER(v)->used;
+    need = 2 * buckets * sizeof(uint64_t);
+    vault_grow(v,table + need);
+
+    h = HEADER(v);
+    old_values = VALUE_BUCKETS(v);
+    values = (uint64_t *) (v->base + table);
+    tokens = values + buckets;
+    memset(values,0,need);
+
+    for(i = 0;i < old_buckets;i++)
+    {
+        o = old_values[i];
+        while(o)
+        {
+            r = RECORD(v,o);
+            next = r->next_value;
+            vh = string_hash(RECORD_DATA(r),(size_t) r->value_len,0);
+            th = string_hash(RECORD_DATA(r) + r->value_len,(size_t) r->token_len,0);
+            r->next_value = values[vh & (buckets - 1)];
+            values[vh & (buckets - 1)] = o;
+            r->next_token = tokens[th & (buckets - 1)];
+            tokens[th & (buckets - 1)] = o;
+            o = next;
+        }
+    }
+
+    h->table = table;
+    h->buckets = buckets;
+    h->used = table + need;
+}
+#endif
+
+struct token_vault *
+open_token_vault(char *file)
+{
+    struct token_vault *v = vaults;
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    struct vault_header *h;
+    char *efile = expand_home(file);
+
+    while(v != NULL)    /* fields using the same file share the mapping and the lock */
+    {
+        if(strcmp(v->file,efile) == 0)
+        {
+            free(efile);
+            return v;
+        }
+        v = v->next;
+    }
+
+    v = xmalloc(sizeof(struct token_vault));
+    v->file = efile;
+    v->base = NULL;
+    v->size = 0;
+    v->fd = open(v->file,O_RDWR | O_CREAT,0600);
+    if(v->fd == -1) panic("Cannot open token vault",v->file,strerror(errno));
+
+    vault_lock(v,F_WRLCK);
+    vault_map(v);
+    if(v->size == 0) vault_create(v);
+
+    h = HEADER(v);
+    if(v->size < sizeof(struct vault_header) || strcmp(h->magic,VAULT_MAGIC) != 0) panic("Invalid token vault",v->file,NULL);
+    if(h->byte_order != VAULT_BYTE_ORDER) panic("Token vault is created in a system having different byte order",v->file,NULL);
+    if(!h->buckets || (h->buckets & (h->buckets - 1)) || h->used > v->size || h->table < sizeof(struct vault_header) ||
+       h->table > h->used || 2 * h->buckets * sizeof(uint64_t) > h->used - h->table) panic("Invalid token vault",v->file,NULL);
+    vault_lock(v,F_UNLCK);
+
+    v->next = vaults;
+    vaults = v;
+#else
+    panic("Token vault needs mmap, which is not available in this system",file,NULL);
+#endif
+    return v;
+}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+static struct vault_record *
+find_value(struct token_vault *v,uint64_t h,uint8_t *value,int value_len,int token_len)
+{
+    uint64_t o = VALUE_BUCKETS(v)[h & (HEADER(v)->buckets - 1)];
+    struct vault_record *r;
+
+    while(o)
+    {
+        r = RECORD(v,o);
+        if(r->value_len == (uint32_t) value_len && r->token_len == (uint32_t) token_len &&
+           memcmp(RECORD_DATA(r),value,value_len) == 0) return r;
+        o = r->next_value;
+    }
+    return NULL;
+}
+
+static int
+token_used(struct token_vault *v,uint64_t h,uint8_t *token,int token_len)
+{
+    uint64_t o = TOKEN_BUCKETS(v)[h & (HEADER(v)->buckets - 1)];
+    struct vault_record *r;
+
+    while(o)
+    {
+        r = RECORD(v,o);
+        if(r->token_len == (uint32_t) token_len && memcmp(RECORD_DATA(r) + r->value_len,token,token_len) == 0) return 1;
+        o = r->next_token;
+    }
+    return 0;
+}
+#endif
+
+/* write the token of value to token. A new token is made with generate
+ * and stored if the value is not in the vault. Tokens of different values
+ * are always different.
+ */
+void
+vault_token(struct token_vault *v,uint8_t *value,int value_len,uint8_t *token,int token_len,
+            void (*generate)(uint8_t *,int,void *),void *arg)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    uint64_t vh = string_hash(value,(size_t) value_len,0),th;
+    struct vault_record *r;
+    struct vault_header *h;
+    uint64_t o,*bucket;
+    size_t need;
+    int tries = 0;
+
+    vault_lock(v,F_RDLCK);
+    if(HEADER(v)->used > v->size) vault_map(v);     /* grown by an other process */
+    r = find_value(v,vh,value,value_len,token_len);
+    if(r != NULL)
+    {
+        memcpy(token,RECORD_DATA(r) + value_len,token_len);
+        vault_lock(v,F_UNLCK);
+        return;
+    }
+
+    /* drop the read lock first, two processes upgrading at the same time
+     * would deadlock. The value can be added while waiting, search again.
+     */
+    vault_lock(v,F_UNLCK);
+    vault_lock(v,F_WRLCK);
+    if(HEADER(v)->used > v->size) vault_map(v);
+    r = find_value(v,vh,value,value_len,token_len);
+    if(r != NULL)
+    {
+        memcpy(token,RECORD_DATA(r) + value_len,token_len);
+        vault_lock(v,F_UNLCK);
+        return;
+    }
+
+    do
+    {
+        if(tries++ == VAULT_TRIES) panic("Cannot make an unique token, all tokens are in use",v->file,NULL);
+        generate(token,token_len,arg);
+        th = string_hash(token,(size_t) token_len,0);
+    } while(token_used(v,th,token,token_len));
+
+    o = HEADER(v)->used;
+    need = sizeof(struct vault_record) + value_len + token_len;
+    need = (need + 7) & ~((size_t) 7);
+    vault_grow(v,o + need);
+
+    h = HEADER(v);
+    r = RECORD(v,o);
+    r->value_len = (uint32_t) value_len;
+    r->token_len = (uint32_t) token_len;
+    memcpy(RECORD_DATA(r),value,value_len);
+    memcpy(RECORD_DATA(r) + value_len,token,token_len);
+
+    bucket = &VALUE_BUCKETS(v)[vh & (h->buckets - 1)];
+    r->next_value = *bucket;
+    *bucket = o;
+    bucket = &TOKEN_BUCKETS(v)[th & (h->buckets - 1)];
+    r->next_token = *bucket;
+    *bucket = o;
+
+    h->used = o + need;
+    h->count++;
+    if(h->count > h->buckets) vault_rehash(v);
+    vault_lock(v,F_UNLCK);
+#endif
+}